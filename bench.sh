@@ -0,0 +1,41 @@
+#!/bin/sh
+# compile speed and code size of -O0/-O1/-O2 on a generated corpus
+set -e
+
+FUNCTIONS=${FUNCTIONS:-20000}
+RUNS=${RUNS:-5}
+
+mkdir -p ./build/bench
+sh ./build.sh
+
+awk -v n="$FUNCTIONS" 'BEGIN {
+    for (i = 0; i < n; i++)
+    {
+        printf "i32 f%d()\n{\n    i32 a = %d + 1;\n", i, i
+        printf "    i32 b = a + %d;\n    i32 c = b + a;\n    i32 d = c + 2 + b;\n", i % 7
+        printf "    return d + c;\n}\n\n"
+    }
+    printf "@proto(main) i32 main()\n{\n    return 7 + 35;\n}\n"
+}' > ./build/bench/corpus.cb
+
+{
+    printf "corpus: %s functions, best of %s runs\n" "$FUNCTIONS" "$RUNS"
+    printf "%-6s %12s %12s\n" "level" "time (ms)" ".text (B)"
+
+    for level in 0 1 2
+    do
+        best=
+        for run in $(seq "$RUNS")
+        do
+            begin=$(date +%s%N)
+            ./build/main -O$level -o ./build/bench/O$level.o ./build/bench/corpus.cb > /dev/null
+            end=$(date +%s%N)
+
+            time=$(( (end - begin) / 1000000 ))
+            if [ -z "$best" ] || [ "$time" -lt "$best" ]; then best=$time; fi
+        done
+
+        text=$(size -A ./build/bench/O$level.o | awk '$1 == ".text" { print $2 }')
+        printf "%-6s %12s %12s\n" "-O$level" "$best" "$text"
+    done
+} | tee bench_output.txt
@@ -1 +1 @@
-gcc src/main.c -I./src/ -Wall -Wextra -Wno-missing-field-initializers -o ./build/main.exe
\ No newline at end of file
+gcc src/main.c -I./src/ -Wall -Wextra -Wno-missing-field-initializers -pthread -o ./build/main.exe
\ No newline at end of file
@@ -0,0 +1,68 @@
+#!/bin/sh
+# runs a program with nested function declarations through every execution mode
+set -e
+
+mkdir -p ./build/check
+sh ./build.sh
+
+cat > ./build/check/nested.cb <<'PROGRAM'
+i32 outer()
+{
+    i32 a = 2;
+    i32 middle()
+    {
+        i32 innermost()
+        {
+            return 7;
+        }
+        i32 m = innermost() + 3;
+        return m;
+    }
+    i32 second()
+    {
+        return 100;
+    }
+    return a + middle();
+}
+
+@proto(main) i32 main()
+{
+    return outer() + innermost() + second();
+}
+PROGRAM
+
+EXPECTED=119
+failed=0
+
+expect()
+{
+    mode=$1
+    shift
+    status=0
+    "$@" > /dev/null || status=$?
+    if [ "$status" -eq "$EXPECTED" ]
+    then
+        printf "%-24s ok\n" "$mode"
+    else
+        printf "%-24s exited with %s, expected %s\n" "$mode" "$status" "$EXPECTED"
+        failed=1
+    fi
+}
+
+for level in 0 1 2
+do
+    ./build/main -O$level -o ./build/check/nested.o ./build/check/nested.cb > /dev/null
+    ld -e main -o ./build/check/nested ./build/check/nested.o
+    expect "object -O$level" ./build/check/nested
+
+    ./build/main -O$level --executable -o ./build/check/nested ./build/check/nested.cb > /dev/null
+    expect "executable -O$level" ./build/check/nested
+
+    expect "run -O$level" ./build/main -O$level --run ./build/check/nested.cb
+    expect "run --lazy -O$level" ./build/main -O$level --run --lazy ./build/check/nested.cb
+    expect "run --tiered -O$level" ./build/main -O$level --run --tiered --tier-threshold 1 ./build/check/nested.cb
+done
+
+expect "interpret" ./build/main --interpret ./build/check/nested.cb
+
+exit $failed
@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "passes.h"
+
+#include "assert.h"
+#include "stb_ds.h"
+
+#define CACHE_MAGIC 0x3868636163626300 // "\0cbcach8"
+
+// FNV-1a
+static u64 hashBytes(u64 hash, const void * data, usize length)
+{
+    const u8 * bytes = data;
+
+    for (usize i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+static u64 hashString(u64 hash, const u8 * string)
+{
+    // include the terminator so that "ab" "c" and "a" "bc" differ
+    return hashBytes(hash, string, strlen((const char *) string) + 1);
+}
+
+static u64 hashToken(u64 hash, const Token * token)
+{
+    if (token == NULL) return hashBytes(hash, &(TokenType){ TT_NONE }, sizeof(TokenType));
+
+    hash = hashBytes(hash, &token->type, sizeof(token->type));
+
+    switch (token->type)
+    {
+        case TT_INT: return hashBytes(hash, &token->value, sizeof(token->value));
+        case TT_ID:  return hashString(hash, token->string);
+        default:     return hash;
+    }
+}
+
+// positions only matter to line mappings, and then they are hashed relative
+// to `base`, the start of the function, so moving a function around never
+// invalidates it
+static u64 hashNode(u64 hash, const Node * node, usize base)
+{
+    if (node == NULL) return hashBytes(hash, &(NodeType){ NT_NONE }, sizeof(NodeType));
+
+    hash = hashBytes(hash, &node->type, sizeof(node->type));
+
+    if (targetOptions.debugInfo)
+    {
+        usize offset = node->begin - base;
+        hash = hashBytes(hash, &offset, sizeof(offset));
+    }
+
+    switch (node->type)
+    {
+        case NT_NAMESPACE:
+        {
+            NodeNamespace * body = (NodeNamespace *) &node->body;
+
+            hash = hashToken(hash, body->name);
+            hash = hashBytes(hash, &body->bodyLen, sizeof(body->bodyLen));
+            for (usize i = 0; i < body->bodyLen; i++) hash = hashNode(hash, body->body[i], base);
+        } break;
+        case NT_FUNC_DECL:
+        {
+            NodeFuncDecl * body = (NodeFuncDecl *) &node->body;
+
+            hash = hashBytes(hash, &body->attributeCount, sizeof(body->attributeCount));
+            for (usize i = 0; i < body->attributeCount; i++)
+            {
+                hash = hashToken(hash, body->attributes[i].name);
+                hash = hashToken(hash, body->attributes[i].value);
+            }
+            hash = hashToken(hash, body->returnType);
+            hash = hashToken(hash, body->name);
+            hash = hashBytes(hash, &body->bodyLen, sizeof(body->bodyLen));
+            for (usize i = 0; i < body->bodyLen; i++) hash = hashNode(hash, body->body[i], base);
+        } break;
+        case NT_RETURN:
+        {
+            NodeReturn * body = (NodeReturn *) &node->body;
+
+            hash = hashNode(hash, body->value, base);
+        } break;
+        case NT_ATOM:
+        {
+            NodeAtom * body = (NodeAtom *) &node->body;
+
+            hash = hashToken(hash, body->token);
+        } break;
+        case NT_ADDITION:
+        {
+            NodeAddition * body = (NodeAddition *) &node->body;
+
+            hash = hashNode(hash, body->left, base);
+            hash = hashNode(hash, body->right, base);
+        } break;
+        case NT_CALL:
+        {
+            NodeCall * body = (NodeCall *) &node->body;
+
+            hash = hashToken(hash, body->name);
+        } break;
+        case NT_VAR_DECL:
+        {
+            NodeVarDecl * body = (NodeVarDecl *) &node->body;
+
+            hash = hashToken(hash, body->type);
+            hash = hashToken(hash, body->name);
+            hash = hashNode(hash, body->value, base);
+        } break;
+        default: assert(0 && "TODO:");
+    }
+
+    return hash;
+}
+
+u64 hashFunction(const Node * node)
+{
+    u64 hash = 0xcbf29ce484222325;
+
+    hash = hashString(hash, (const u8 *) COMPILER_VERSION);
+    hash = hashString(hash, (const u8 *) pipelineSpec());
+    hash = hashBytes(hash, &targetOptions.allocateRegisters, sizeof(targetOptions.allocateRegisters));
+    hash = hashBytes(hash, &targetOptions.packStackSlots, sizeof(targetOptions.packStackSlots));
+    hash = hashBytes(hash, &targetOptions.selectInstructions, sizeof(targetOptions.selectInstructions));
+    hash = hashBytes(hash, &targetOptions.peephole, sizeof(targetOptions.peephole));
+    // entries only carry peephole statistics when they were gathered
+    hash = hashBytes(hash, &targetOptions.reportPeephole, sizeof(targetOptions.reportPeephole));
+    // as do line mappings
+    hash = hashBytes(hash, &targetOptions.debugInfo, sizeof(targetOptions.debugInfo));
+    hash = hashString(hash, functionProtocol(node));
+    hash = hashNode(hash, node, node->begin);
+
+    return hash;
+}
+
+static void cachePath(char * path, usize pathSize, const char * cacheDir, u64 key)
+{
+    assert(snprintf(path, pathSize, "%s/%016lx", cacheDir, key) < (int) pathSize);
+}
+
+typedef struct {
+    FILE * file;
+    // bytes of the file not read yet, which bounds every length read from it
+    u64    remaining;
+} CacheReader;
+
+static bool readValue(CacheReader * reader, void * data, usize size)
+{
+    if (size > reader->remaining) return false;
+    reader->remaining -= size;
+
+    return fread(data, 1, size, reader->file) == size;
+}
+
+// reads the length of an array whose elements take at least `elementSize`
+// bytes each, so a corrupt length fails here instead of in an allocation
+static bool readLength(CacheReader * reader, u64 * length, usize elementSize)
+{
+    return readValue(reader, length, sizeof(*length)) && *length <= reader->remaining / elementSize;
+}
+
+static bool readString(CacheReader * reader, u8 ** string)
+{
+    u64 length;
+    if (!readLength(reader, &length, 1)) return false;
+
+    *string = malloc(length + 1);
+    assert(*string);
+    (*string)[length] = '\0';
+
+    return readValue(reader, *string, length);
+}
+
+static void freeLoaded(Symbol * functionTable, FunctionCode * functions, u8 * program)
+{
+    for (usize i = 0; i < arrlenu(functions); i++)
+    {
+        for (usize j = 0; j < arrlenu(functions[i].calls); j++) free(functions[i].calls[j].callee);
+
+        arrfree(functions[i].cfi);
+        arrfree(functions[i].lines);
+        arrfree(functions[i].calls);
+    }
+    for (usize i = 0; i < arrlenu(functionTable); i++) free(functionTable[i].name);
+
+    arrfree(functionTable);
+    arrfree(functions);
+    arrfree(program);
+}
+
+// the fixed part of a stored function: its name, cfi, line and call counts and
+// address, size, layout, linkage, peepholeSaved and exits
+#define STORED_FUNCTION_SIZE (10 * sizeof(u64))
+// the offset and callee length of a call site
+#define STORED_CALL_SIZE (2 * sizeof(u64))
+
+bool loadFunction(const char * cacheDir, u64 key, FunctionJob * job)
+{
+    char path[4096];
+    cachePath(path, sizeof(path), cacheDir, key);
+
+    FILE * file = fopen(path, "rb");
+    if (file == NULL) return false;
+
+    struct stat info;
+    if (fstat(fileno(file), &info) != 0)
+    {
+        fclose(file);
+        return false;
+    }
+
+    CacheReader reader = { file, (u64) info.st_size };
+
+    u64 magic, storedKey, functionCount, programLen;
+    bool ok = readValue(&reader, &magic, sizeof(magic)) && magic == CACHE_MAGIC
+           && readValue(&reader, &storedKey, sizeof(storedKey)) && storedKey == key
+           && readLength(&reader, &functionCount, STORED_FUNCTION_SIZE);
+
+    // FIXME: memory leak!
+    Symbol * functionTable = NULL;
+    FunctionCode * functions = NULL;
+    u8 * program = NULL;
+
+    for (u64 i = 0; ok && i < functionCount; i++)
+    {
+        // pushed right away so that a failure frees whatever was read of it
+        arrpush(functionTable, ((Symbol){ NULL, 0 }));
+        arrpush(functions, ((FunctionCode){ 0 }));
+        Symbol * symbol = &functionTable[i];
+        FunctionCode * function = &functions[i];
+
+        u64 address, size, layout, linkage, peepholeSaved, exits, cfiLen, lineCount, callCount;
+        ok = readString(&reader, &symbol->name) && readValue(&reader, &address, sizeof(address))
+          && readValue(&reader, &size, sizeof(size)) && readValue(&reader, &layout, sizeof(layout))
+          && readValue(&reader, &linkage, sizeof(linkage))
+          && readValue(&reader, &peepholeSaved, sizeof(peepholeSaved))
+          && readValue(&reader, &exits, sizeof(exits))
+          && readLength(&reader, &cfiLen, 1);
+        if (!ok) break;
+
+        *function = (FunctionCode){ address, size, (Layout) layout, peepholeSaved, NULL, NULL, NULL, exits, (Linkage) linkage };
+
+        arrsetlen(function->cfi, cfiLen);
+        ok = readValue(&reader, function->cfi, cfiLen) && readLength(&reader, &lineCount, sizeof(LineMapping));
+        if (!ok) break;
+
+        arrsetlen(function->lines, lineCount);
+        ok = readValue(&reader, function->lines, lineCount * sizeof(LineMapping)) && readLength(&reader, &callCount, STORED_CALL_SIZE);
+        if (!ok) break;
+
+        // stored relative to the start of the function
+        for (u64 j = 0; j < lineCount; j++) function->lines[j].sourceOffset += job->node->begin;
+
+        for (u64 j = 0; ok && j < callCount; j++)
+        {
+            u64 offset;
+            u8 * callee = NULL;
+            ok = readValue(&reader, &offset, sizeof(offset)) && readString(&reader, &callee);
+
+            // the string may be partially read, it is freed along with the rest
+            arrpush(function->calls, ((CallSite){ offset, callee }));
+            // the rel32 of a call lies within its function
+            ok = ok && offset <= size && size - offset >= 4;
+        }
+    }
+
+    ok = ok && readLength(&reader, &programLen, 1);
+    if (ok)
+    {
+        arrsetlen(program, programLen);
+        // nothing may follow the code either
+        ok = readValue(&reader, program, programLen) && reader.remaining == 0;
+    }
+
+    // every function has to lie within the code that came with it
+    for (u64 i = 0; ok && i < functionCount; i++)
+    {
+        ok = functions[i].size <= programLen && functions[i].address <= programLen - functions[i].size;
+    }
+
+    fclose(file);
+
+    if (!ok)
+    {
+        // a truncated or foreign entry is treated as a miss and overwritten later
+        freeLoaded(functionTable, functions, program);
+        return false;
+    }
+
+    job->functionTable     = functionTable;
+    job->functionCount     = functionCount;
+    job->functions         = functions;
+    job->program           = program;
+    return true;
+}
+
+void storeFunction(const char * cacheDir, u64 key, const FunctionJob * job)
+{
+    char path[4096];
+    cachePath(path, sizeof(path), cacheDir, key);
+
+    // write to a private file first so that concurrent builds never observe a
+    // partially written entry. the job is only unique within this process, so
+    // the process id keeps other builds sharing the cache out of it
+    char temporaryPath[4096 + 48];
+    assert(snprintf(temporaryPath, sizeof(temporaryPath), "%s.%ld.%p.tmp", path, (long) getpid(), (const void *) job) < (int) sizeof(temporaryPath));
+
+    FILE * file = fopen(temporaryPath, "wb");
+    // the cache is only an optimization
+    if (file == NULL) return;
+
+    u64 magic = CACHE_MAGIC, functionCount = job->functionCount, programLen = arrlenu(job->program);
+    bool ok = fwrite(&magic, sizeof(magic), 1, file) == 1
+           && fwrite(&key, sizeof(key), 1, file) == 1
+           && fwrite(&functionCount, sizeof(functionCount), 1, file) == 1;
+
+    for (usize i = 0; ok && i < job->functionCount; i++)
+    {
+        u64 nameLen = strlen((const char *) job->functionTable[i].name);
+        const FunctionCode * function = &job->functions[i];
+        u64 address = function->address, size = function->size, layout = function->layout, linkage = function->linkage, peepholeSaved = function->peepholeSaved, exits = function->exits;
+        u64 cfiLen = arrlenu(function->cfi), lineCount = arrlenu(function->lines);
+
+        ok = fwrite(&nameLen, sizeof(nameLen), 1, file) == 1
+          && fwrite(job->functionTable[i].name, 1, nameLen, file) == nameLen
+          && fwrite(&address, sizeof(address), 1, file) == 1
+          && fwrite(&size, sizeof(size), 1, file) == 1
+          && fwrite(&layout, sizeof(layout), 1, file) == 1
+          && fwrite(&linkage, sizeof(linkage), 1, file) == 1
+          && fwrite(&peepholeSaved, sizeof(peepholeSaved), 1, file) == 1
+          && fwrite(&exits, sizeof(exits), 1, file) == 1
+          && fwrite(&cfiLen, sizeof(cfiLen), 1, file) == 1
+          && (cfiLen == 0 || fwrite(function->cfi, 1, cfiLen, file) == cfiLen)
+          && fwrite(&lineCount, sizeof(lineCount), 1, file) == 1;
+
+        // stored relative to the start of the function, one at a time as there
+        // are none without -g and one per statement with it
+        for (u64 j = 0; ok && j < lineCount; j++)
+        {
+            LineMapping line = { function->lines[j].address, function->lines[j].sourceOffset - job->node->begin };
+            ok = fwrite(&line, sizeof(line), 1, file) == 1;
+        }
+
+        u64 callCount = arrlenu(function->calls);
+        ok = ok && fwrite(&callCount, sizeof(callCount), 1, file) == 1;
+
+        for (u64 j = 0; ok && j < callCount; j++)
+        {
+            u64 offset = function->calls[j].offset, calleeLen = strlen((const char *) function->calls[j].callee);
+
+            ok = fwrite(&offset, sizeof(offset), 1, file) == 1
+              && fwrite(&calleeLen, sizeof(calleeLen), 1, file) == 1
+              && fwrite(function->calls[j].callee, 1, calleeLen, file) == calleeLen;
+        }
+    }
+
+    ok = ok && fwrite(&programLen, sizeof(programLen), 1, file) == 1
+            && fwrite(job->program, 1, programLen, file) == programLen;
+
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok || rename(temporaryPath, path) != 0) remove(temporaryPath);
+}
+
+void createCache(const char * cacheDir)
+{
+    struct stat info;
+    if (stat(cacheDir, &info) == 0) assert(S_ISDIR(info.st_mode));
+    else assert(mkdir(cacheDir, 0777) == 0);
+}
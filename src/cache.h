@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "number.h"
+#include "parser.h"
+#include "parallel.h"
+
+// identifies the machine code of a function: a hash of its AST subtree, its
+// calling protocol, the pass pipeline, the target options and COMPILER_VERSION
+u64 hashFunction(const Node * node);
+
+// makes sure `cacheDir` exists
+void createCache(const char * cacheDir);
+
+// fills in the results of `job` from `cacheDir`, returns false on a miss
+bool loadFunction(const char * cacheDir, u64 key, FunctionJob * job);
+
+void storeFunction(const char * cacheDir, u64 key, const FunctionJob * job);
@@ -16,51 +16,102 @@ static void compileNamespace(Context c, const Node * node)
     }
 }
 
-static void compileFunctionDeclaration(Context c, const Node * node)
+const Token * functionAttribute(const Node * node, const char * name)
 {
     assert(node->type == NT_FUNC_DECL);
     NodeFuncDecl * body = (NodeFuncDecl *) &node->body;
 
-    // FIXME: memory leak!
-    Instruction * instructions = NULL;
-    usize slotCount = *c.sc;
-
-    u8 * proto;
-    if (body->attributeName != NULL && strcmp((char *) body->attributeName->string, "proto") == 0)
+    for (usize i = 0; i < body->attributeCount; i++)
     {
-        assert(body->attributeValue != NULL);
-
-        proto = body->attributeValue->string;
+        if (strcmp((char *) body->attributes[i].name->string, name) == 0) return body->attributes[i].value;
     }
+
+    return NULL;
+}
+
+u8 * functionProtocol(const Node * node)
+{
+    assert(node->type == NT_FUNC_DECL);
+    NodeFuncDecl * body = (NodeFuncDecl *) &node->body;
+
+    const Token * proto = functionAttribute(node, "proto");
+
+    if (proto != NULL)
+        return proto->string;
     else if (strcmp((char *) body->name->string, "main") == 0)
-        proto = (u8 *) "main";
+        return (u8 *) "main";
+    else
+        return (u8 *) "default";
+}
+
+Layout functionLayout(const Node * node)
+{
+    const Token * layout = functionAttribute(node, "layout");
+
+    if (layout == NULL)
+        return LAYOUT_DEFAULT;
+    else if (strcmp((char *) layout->string, "hot") == 0)
+        return LAYOUT_HOT;
+    else if (strcmp((char *) layout->string, "cold") == 0)
+        return LAYOUT_COLD;
+    else
+        assert(0 && "unknown layout");
+}
+
+Linkage functionLinkage(const Node * node)
+{
+    const Token * linkage = functionAttribute(node, "linkage");
+
+    if (linkage == NULL)
+        return LINKAGE_DEFAULT;
+    else if (strcmp((char *) linkage->string, "inline") == 0)
+        return LINKAGE_INLINE;
     else
-        proto = (u8 *) "default";
+        assert(0 && "unknown linkage");
+}
+
+static void compileFunctionDeclaration(Context c, const Node * node)
+{
+    assert(node->type == NT_FUNC_DECL);
+    NodeFuncDecl * body = (NodeFuncDecl *) &node->body;
+
+    usize slotCount = *c.sc;
+    // locals are only visible inside the function that declares them
+    usize scope = arrlenu(*c.st);
+
+    u8 * proto = functionProtocol(node);
+
+    // the slot count isn't known until the body is compiled, so reserve the
+    // header now and patch it afterwards
+    usize header = arrlenu(*c.is);
+    arrpush(*c.is, ((Instruction){ IT_BEGIN_SCOPE, .slotCount = 0, .sourceOffset = node->begin }));
+
+    arrpush(*c.is, ((Instruction){ IT_FUNC_BEGIN, .jmpProtocol = proto, .layout = functionLayout(node), .linkage = functionLinkage(node), .sourceOffset = node->begin }));
 
     Context context = c;
-    context.is = &instructions;
     context.sc = &slotCount;
     context.pt = proto;
-    for (usize i = 0; i < body->bodyLen; i++)
-    {
-        compileStatement(context, body->body[i]);
-    }
-
-
-    arrpush(*c.is, ((Instruction){ IT_BEGIN_SCOPE, .slotCount = slotCount - *c.sc }));
 
-    arrpush(*c.is, ((Instruction){ IT_FUNC_BEGIN, .jmpProtocol = proto }));
+    // the instructions of every function have to be contiguous, so nested
+    // declarations are compiled once this one is done. they see the same
+    // names a function declared next to it would
+    const Node ** nested = NULL;
 
-    // FIXME: eww
-    for (usize i = 0; i < arrlenu(instructions); i++)
+    for (usize i = 0; i < body->bodyLen; i++)
     {
-        arrpush(*c.is, instructions[i]);
+        if (body->body[i]->type == NT_FUNC_DECL) arrpush(nested, body->body[i]);
+        else compileStatement(context, body->body[i]);
     }
-    arrfree(instructions);
+
+    (*c.is)[header].slotCount = slotCount - *c.sc;
+    arrsetlen(*c.st, scope);
 
     arrpush(*c.ft, ((Symbol){ body->name->string, arrlenu(*c.is) }));
     
-    arrpush(*c.is, ((Instruction){ IT_END_SCOPE }));
+    arrpush(*c.is, ((Instruction){ IT_END_SCOPE, .sourceOffset = node->begin }));
+
+    for (usize i = 0; i < arrlenu(nested); i++) compileFunctionDeclaration(c, nested[i]);
+    arrfree(nested);
 }
 
 static void compileReturn(Context c, const Node * node)
@@ -71,10 +122,10 @@ static void compileReturn(Context c, const Node * node)
     if (body->value != NULL)
     {
         usize srcSlot = compileExpression(c, body->value);
-        arrpush(*c.is, ((Instruction){ IT_RET_MOVE_32, .srcSlot = srcSlot, .dstSlot = 0, .movProtocol = c.pt }));
+        arrpush(*c.is, ((Instruction){ IT_RET_MOVE_32, .srcSlot = srcSlot, .dstSlot = 0, .movProtocol = c.pt, .sourceOffset = node->begin }));
     }
 
-    arrpush(*c.is, ((Instruction){ IT_RETURN, .jmpProtocol = c.pt }));
+    arrpush(*c.is, ((Instruction){ IT_RETURN, .jmpProtocol = c.pt, .sourceOffset = node->begin }));
 }
 
 static void compileVariableDeclaration(Context c, const Node * node)
@@ -86,7 +137,7 @@ static void compileVariableDeclaration(Context c, const Node * node)
 
     usize srcSlot = compileExpression(c, body->value);
     usize dstSlot = (*c.sc)++;
-    arrpush(*c.is, ((Instruction){ IT_MOVE_32, .srcSlot = srcSlot, .dstSlot = dstSlot }));
+    arrpush(*c.is, ((Instruction){ IT_MOVE_32, .srcSlot = srcSlot, .dstSlot = dstSlot, .sourceOffset = node->begin }));
 
     arrpush(*c.st, ((Symbol){ .name = body->name->string, .value = dstSlot }));
 }
@@ -104,7 +155,7 @@ static usize compileAtom(Context c, const Node * node)
     {
         case TT_INT:
         {
-            arrpush(*c.is, ((Instruction){ IT_VALUE_32, .dstSlot = outSlot, .srcValue32 = (u32) token->value }));
+            arrpush(*c.is, ((Instruction){ IT_VALUE_32, .dstSlot = outSlot, .srcValue32 = (u32) token->value, .sourceOffset = node->begin }));
         } break;
         case TT_ID:
         {
@@ -123,7 +174,7 @@ static usize compileAtom(Context c, const Node * node)
 
             assert(found);
 
-            arrpush(*c.is, ((Instruction){ IT_MOVE_32, .dstSlot = outSlot, .srcSlot = srcSlot }));
+            arrpush(*c.is, ((Instruction){ IT_MOVE_32, .dstSlot = outSlot, .srcSlot = srcSlot, .sourceOffset = node->begin }));
         } break;
         default: assert(0 && "TODO:");
     }
@@ -141,8 +192,21 @@ static usize compileAddition(Context c, const Node * node)
 
     usize outSlot = (*c.sc)++;
 
-    arrpush(*c.is, ((Instruction){ IT_MOVE_32, .dstSlot = outSlot, .srcSlot = leftSlot }));
-    arrpush(*c.is, ((Instruction){ IT_ADD_32, .dstSlot = outSlot, .srcSlot = rightSlot }));
+    arrpush(*c.is, ((Instruction){ IT_MOVE_32, .dstSlot = outSlot, .srcSlot = leftSlot, .sourceOffset = node->begin }));
+    arrpush(*c.is, ((Instruction){ IT_ADD_32, .dstSlot = outSlot, .srcSlot = rightSlot, .sourceOffset = node->begin }));
+
+    return outSlot;
+}
+
+static usize compileCall(Context c, const Node * node)
+{
+    assert(node->type == NT_CALL);
+    NodeCall * body = (NodeCall *) &node->body;
+
+    usize outSlot = (*c.sc)++;
+
+    // resolved when the object is emitted, callees may be defined later or elsewhere
+    arrpush(*c.is, ((Instruction){ IT_CALL_32, .dstSlot = outSlot, .callee = body->name->string, .sourceOffset = node->begin }));
 
     return outSlot;
 }
@@ -153,6 +217,7 @@ static usize compileExpression(Context c, const Node * node)
     {
         case NT_ATOM:     return compileAtom(c, node);
         case NT_ADDITION: return compileAddition(c, node);
+        case NT_CALL:     return compileCall(c, node);
         default: assert(0 && "TODO:");
     }
 }
@@ -169,6 +234,50 @@ static void compileStatement(Context c, const Node * node)
     }
 }
 
+static void collectNamespace(const Node * node, const Node *** functions)
+{
+    assert(node->type == NT_NAMESPACE);
+    NodeNamespace * body = (NodeNamespace *) &node->body;
+
+    for (usize i = 0; i < body->bodyLen; i++)
+    {
+        switch (body->body[i]->type)
+        {
+            case NT_NAMESPACE: collectNamespace(body->body[i], functions); break;
+            case NT_FUNC_DECL: arrpush(*functions, body->body[i]); break;
+            default:           assert(0 && "TODO:");
+        }
+    }
+}
+
+const Node ** collectFunctions(const Node * ast, usize * functionCount)
+{
+    // FIXME: memory leak!
+    const Node ** functions = NULL;
+
+    collectNamespace(ast, &functions);
+
+    *functionCount = arrlenu(functions);
+    return functions;
+}
+
+Instruction * compileFunction(const Node * node, Symbol ** functionTable, usize * functionCount, usize * instructionCount)
+{
+    // FIXME: memory leak!
+    Instruction * instructionStream = NULL;
+    Symbol * symbolTable = NULL;
+    Symbol * ft = NULL;
+    usize slotCount = 0;
+
+    compileFunctionDeclaration((Context){ &instructionStream, &slotCount, &symbolTable, &ft, NULL }, node);
+    arrfree(symbolTable);
+
+    *functionTable = ft;
+    *functionCount = arrlenu(ft);
+    *instructionCount = arrlen(instructionStream);
+    return instructionStream;
+}
+
 Instruction * compile(const Node * ast, Symbol ** functionTable, usize * functionCount, usize * instructionCount)
 {
     // FIXME: memory leak!
@@ -3,6 +3,21 @@
 #include "number.h"
 #include "parser.h"
 
+// bumped whenever the generated code changes, invalidating cached functions
+#define COMPILER_VERSION "cb-0.8"
+
+// where a function is placed in .text, set with @layout(hot) and @layout(cold)
+typedef u8 Layout;
+#define LAYOUT_HOT     0
+#define LAYOUT_DEFAULT 1
+#define LAYOUT_COLD    2
+
+// how a function is linked, set with @linkage(inline)
+typedef u8 Linkage;
+#define LINKAGE_DEFAULT 0
+// may be defined by several objects, the linker keeps one of the definitions
+#define LINKAGE_INLINE  1
+
 typedef u8 InstructionType;
 #define IT_NONE        0
 #define IT_VALUE_32    1
@@ -13,12 +28,13 @@ typedef u8 InstructionType;
 #define IT_MOVE_32     6
 #define IT_ADD_32      7
 #define IT_FUNC_BEGIN  8
+#define IT_CALL_32     9
 
 typedef struct {
     InstructionType type;
 
     union {
-        // IT_VALUE_32, IT_RET_SET_32, IT_MOVE_32. IT_ADD_32
+        // IT_VALUE_32, IT_RET_SET_32, IT_MOVE_32. IT_ADD_32, IT_CALL_32
         struct {
             usize dstSlot;
 
@@ -38,6 +54,10 @@ typedef struct {
                 struct {
                     u32 srcValue32;
                 };
+                // IT_CALL_32, the result is stored in `dstSlot`
+                struct {
+                    u8 * callee;
+                };
             };
         };
         // IT_BEGIN_SCOPE
@@ -47,8 +67,15 @@ typedef struct {
         // IT_FUNC_BEGIN, IT_RETURN
         struct {
             u8 * jmpProtocol;
+
+            // IT_FUNC_BEGIN
+            Layout  layout;
+            Linkage linkage;
         };
     };
+
+    // where in the source the node the instruction was compiled from begins
+    usize sourceOffset;
 } Instruction;
 
 typedef struct {
@@ -67,4 +94,23 @@ typedef struct {
 static usize compileExpression(Context c, const Node * node);
 static void compileStatement(Context c, const Node * node);
 
+// the value of the attribute `name` of an NT_FUNC_DECL, NULL if it has none
+const Token * functionAttribute(const Node * node, const char * name);
+
+// the calling protocol an NT_FUNC_DECL is compiled with
+u8 * functionProtocol(const Node * node);
+
+// where an NT_FUNC_DECL goes in .text
+Layout functionLayout(const Node * node);
+
+// how an NT_FUNC_DECL is linked
+Linkage functionLinkage(const Node * node);
+
+// returns every function declared in `ast` (and its nested namespaces) in source order
+const Node ** collectFunctions(const Node * ast, usize * functionCount);
+
+// compiles a single NT_FUNC_DECL into a stream of its own; the result is
+// independent of every other function, so this may be called concurrently
+Instruction * compileFunction(const Node * node, Symbol ** functionTable, usize * functionCount, usize * instructionCount);
+
 Instruction * compile(const Node * ast, Symbol ** functionTable, usize * functionCount, usize * instructionCount);
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef DWARF_H_
+#define DWARF_H_
+
+#include <stdint.h>
+
+#define DWARF_CIE_ID_EH_FRAME 0
+#define DWARF_CIE_VERSION     1
+
+typedef uint8_t DwarfPointerEncoding;
+#define DWARF_POINTER_ABSOLUTE 0x00
+#define DWARF_POINTER_SDATA4   0x0b
+#define DWARF_POINTER_PCREL    0x10
+
+typedef uint8_t DwarfCallFrameOp;
+#define DWARF_CFA_NOP            0x00
+#define DWARF_CFA_ADVANCE_LOC1   0x02
+#define DWARF_CFA_ADVANCE_LOC2   0x03
+#define DWARF_CFA_ADVANCE_LOC4   0x04
+#define DWARF_CFA_REMEMBER_STATE 0x0a
+#define DWARF_CFA_RESTORE_STATE  0x0b
+#define DWARF_CFA_DEF_CFA        0x0c
+#define DWARF_CFA_DEF_CFA_OFFSET 0x0e
+// the operand is stored in the low six bits
+#define DWARF_CFA_ADVANCE_LOC    0x40
+#define DWARF_CFA_OFFSET         0x80
+
+#define DWARF_VERSION_4 4
+
+typedef uint8_t DwarfTag;
+#define DWARF_TAG_COMPILE_UNIT 0x11
+
+#define DWARF_CHILDREN_NO  0
+#define DWARF_CHILDREN_YES 1
+
+typedef uint8_t DwarfAttribute;
+#define DWARF_AT_NAME      0x03
+#define DWARF_AT_STMT_LIST 0x10
+#define DWARF_AT_LOW_PC    0x11
+#define DWARF_AT_HIGH_PC   0x12
+#define DWARF_AT_COMP_DIR  0x1b
+#define DWARF_AT_PRODUCER  0x25
+#define DWARF_AT_RANGES    0x55
+
+typedef uint8_t DwarfForm;
+#define DWARF_FORM_ADDR       0x01
+#define DWARF_FORM_DATA8      0x07
+#define DWARF_FORM_STRING     0x08
+#define DWARF_FORM_SEC_OFFSET 0x17
+
+typedef uint8_t DwarfLineOp;
+#define DWARF_LNS_COPY         0x01
+#define DWARF_LNS_ADVANCE_PC   0x02
+#define DWARF_LNS_ADVANCE_LINE 0x03
+// extended opcodes follow a zero byte and their length
+#define DWARF_LNE_END_SEQUENCE 0x01
+#define DWARF_LNE_SET_ADDRESS  0x02
+
+// the parameters of the special opcodes in the line number programs emitted
+#define DWARF_LINE_BASE   (-5)
+#define DWARF_LINE_RANGE  14
+#define DWARF_OPCODE_BASE 13
+
+// x86_64 register numbers, which differ from the ones used in encodings
+#define DWARF_X86_64_RSP            7
+#define DWARF_X86_64_RETURN_ADDRESS 16
+
+#endif
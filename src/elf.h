@@ -56,6 +56,27 @@ typedef uint32_t ElfSectionType;
 #define ELF_SECTION_TYPE_PREINITIALIZERS 16
 #define ELF_SECTION_TYPE_GROUP           17
 #define ELF_SECTION_TYPE_EXT_INDICES     18
+#define ELF_SECTION_TYPE_X86_64_UNWIND   0x70000001
+
+// the section index of symbols defined in some other object
+#define ELF_SECTION_INDEX_UNDEFINED 0
+
+// the first word of a group section
+#define ELF_GROUP_COMDAT 0x1
+
+typedef uint32_t ElfSegmentType;
+#define ELF_SEGMENT_TYPE_NULL      0
+#define ELF_SEGMENT_TYPE_LOAD      1
+#define ELF_SEGMENT_TYPE_DYNAMIC   2
+#define ELF_SEGMENT_TYPE_INTERP    3
+#define ELF_SEGMENT_TYPE_NOTE      4
+#define ELF_SEGMENT_TYPE_HEADERS   6
+#define ELF_SEGMENT_TYPE_GNU_STACK 0x6474e551
+
+typedef uint32_t ElfSegmentFlags;
+#define ELF_SEGMENT_FLAG_EXEC  0x1
+#define ELF_SEGMENT_FLAG_WRITE 0x2
+#define ELF_SEGMENT_FLAG_READ  0x4
 
 typedef uint64_t ElfSectionFlags;
 #define ELF_SECTION_FLAG_WRITE          0x001
@@ -92,6 +113,16 @@ typedef uint64_t ElfSectionFlags;
 #define ELF_SYMBOL_TYPE(info)          ((info) & 0xf)
 #define ELF_SYMBOL_INFO(binding, type) (((binding) << 4) | ((type) & 0xf))
 
+#define ELF_RELOCATION_X86_64_NONE  0
+#define ELF_RELOCATION_X86_64_64    1
+#define ELF_RELOCATION_X86_64_PC32  2
+#define ELF_RELOCATION_X86_64_PLT32 4
+#define ELF_RELOCATION_X86_64_32    10
+
+#define ELF_RELOCATION_SYMBOL(info)       ((info) >> 32)
+#define ELF_RELOCATION_TYPE(info)         ((info) & 0xffffffff)
+#define ELF_RELOCATION_INFO(symbol, type) (((uint64_t)(symbol) << 32) | ((type) & 0xffffffff))
+
 #define ELF_SYMBOL_VISIBILITY(other) ((other) & 0x3)
 #define ELF_SYMBOL_OTHER(visibility) ((visibility) & 0x3)
 
@@ -121,6 +152,17 @@ typedef struct {
     uint16_t     sectionNameTableIndex;
 } Elf64Header;
 
+typedef struct {
+    ElfSegmentType  type;
+    ElfSegmentFlags flags;
+    uint64_t        offset;
+    uint64_t        virtualAddress;
+    uint64_t        physicalAddress;
+    uint64_t        fileSize;
+    uint64_t        memorySize;
+    uint64_t        alignment;
+} Elf64ProgramHeader;
+
 typedef struct {
     uint32_t        name;
     ElfSectionType  type;
@@ -143,4 +185,10 @@ typedef struct {
     uint64_t size;
 } Elf64Symbol;
 
+typedef struct {
+    uint64_t offset;
+    uint64_t info;
+    int64_t  addend;
+} Elf64Relocation;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,310 @@
+#include <stdio.h>
+
+#include "interpreter.h"
+
+#include "assert.h"
+#include "stb_ds.h"
+
+// the stream is decoded into ops of its own that are threaded before they are
+// run: every op holds the address of the code handling it, which jumps straight
+// to the handler of the next one (a gcc extension, like in most interpreters)
+
+typedef u8 OpCode;
+#define OP_VALUE         0
+#define OP_MOVE          1
+#define OP_ADD           2
+#define OP_RESULT        3
+#define OP_RETURN        4
+// OP_RESULT followed by OP_RETURN, the end of almost every function
+#define OP_RETURN_RESULT 5
+#define OP_CALL          6
+#define OP_COUNT         7
+
+typedef struct {
+    union {
+        usize        code;
+        const void * handler;
+    };
+
+    // the slot written
+    u32 a;
+    // the slot read, the value of OP_VALUE or the function OP_CALL calls
+    u32 b;
+} Op;
+
+typedef struct {
+    usize entry;
+    // one past the highest slot the function uses
+    usize registerCount;
+    // the ir has no jumps and so no back edges, calls are all there is to count
+    u32   calls;
+} InterpretedFunction;
+
+typedef struct {
+    const Op * entry;
+    // the call to go back to once the function returns, NULL for main
+    const Op * call;
+    i32 *      registers;
+    usize      registerCount;
+} InterpreterFrame;
+
+// the deepest calls can nest, there are no conditions that would end a
+// recursion anyway
+#define INTERPRETER_MAX_DEPTH     (1 << 16)
+#define INTERPRETER_MAX_REGISTERS (1 << 22)
+
+typedef struct {
+    // FIXME: memory leak!
+    Op *                  ops;
+    InterpretedFunction * functions;
+    const Symbol *        functionTable;
+    usize                 functionCount;
+
+    InterpreterFrame *    frames;
+    i32 *                 registers;
+} Interpreter;
+
+static void pushOp(Interpreter * interpreter, InterpretedFunction * function, Op op)
+{
+    if (op.code == OP_MOVE || op.code == OP_ADD || op.code == OP_RESULT || op.code == OP_RETURN_RESULT)
+    {
+        if (op.b >= function->registerCount) function->registerCount = op.b + 1;
+    }
+    if (op.code == OP_VALUE || op.code == OP_MOVE || op.code == OP_ADD || op.code == OP_CALL)
+    {
+        if (op.a >= function->registerCount) function->registerCount = op.a + 1;
+    }
+
+    // returning whatever the previous op just set aside
+    if (op.code == OP_RETURN && arrlenu(interpreter->ops) != 0 && arrlast(interpreter->ops).code == OP_RESULT)
+    {
+        arrlast(interpreter->ops).code = OP_RETURN_RESULT;
+        return;
+    }
+
+    arrpush(interpreter->ops, op);
+}
+
+static void decode(Interpreter * interpreter, const Instruction * instructions, usize instructionCount)
+{
+    struct { char * key; usize value; } * byName = NULL;
+    for (usize i = 0; i < interpreter->functionCount; i++) shput(byName, (char *) interpreter->functionTable[i].name, i);
+
+    usize currentFunction = 0;
+    InterpretedFunction * function = NULL;
+
+    for (usize i = 0; i < instructionCount; i++)
+    {
+        Instruction instruction = instructions[i];
+
+        switch (instruction.type)
+        {
+            case IT_BEGIN_SCOPE:
+            {
+                // the compiler lays nested functions out after the one declaring
+                // them, so a function never starts inside another one
+                assert(function == NULL && "functions have to be contiguous");
+                assert(currentFunction < interpreter->functionCount);
+                function = &interpreter->functions[currentFunction++];
+                *function = (InterpretedFunction){ arrlenu(interpreter->ops), instruction.slotCount, 0 };
+            } break;
+            case IT_FUNC_BEGIN: break;
+            case IT_VALUE_32:    pushOp(interpreter, function, (Op){ .code = OP_VALUE, .a = instruction.dstSlot, .b = instruction.srcValue32 }); break;
+            case IT_MOVE_32:     pushOp(interpreter, function, (Op){ .code = OP_MOVE, .a = instruction.dstSlot, .b = instruction.srcSlot }); break;
+            case IT_ADD_32:      pushOp(interpreter, function, (Op){ .code = OP_ADD, .a = instruction.dstSlot, .b = instruction.srcSlot }); break;
+            case IT_RET_MOVE_32: pushOp(interpreter, function, (Op){ .code = OP_RESULT, .a = 0, .b = instruction.srcSlot }); break;
+            // falling off the end of a function returns as well
+            case IT_RETURN:      pushOp(interpreter, function, (Op){ .code = OP_RETURN }); break;
+            case IT_END_SCOPE:
+            {
+                pushOp(interpreter, function, (Op){ .code = OP_RETURN });
+                function = NULL;
+            } break;
+            case IT_CALL_32:
+            {
+                i64 callee = shgeti(byName, (char *) instruction.callee);
+                if (callee < 0)
+                {
+                    printf("undefined function '%s'\n", instruction.callee);
+                    exit(1);
+                }
+
+                pushOp(interpreter, function, (Op){ .code = OP_CALL, .a = instruction.dstSlot, .b = byName[callee].value });
+            } break;
+            default: assert(0 && "TODO:");
+        }
+    }
+
+    assert(currentFunction == interpreter->functionCount);
+    shfree(byName);
+}
+
+static i32 execute(Interpreter * interpreter, usize function, const TierPolicy * tiers, InterpreterStatistics * statistics)
+{
+    static const void * handlers[OP_COUNT] = {
+        [OP_VALUE]         = &&value,
+        [OP_MOVE]          = &&move,
+        [OP_ADD]           = &&add,
+        [OP_RESULT]        = &&result,
+        [OP_RETURN]        = &&return_,
+        [OP_RETURN_RESULT] = &&returnResult,
+        [OP_CALL]          = &&call,
+    };
+
+    for (usize i = 0; i < arrlenu(interpreter->ops); i++) interpreter->ops[i].handler = handlers[interpreter->ops[i].code];
+
+    InterpreterFrame * frame = interpreter->frames;
+    InterpreterFrame * lastFrame = interpreter->frames + INTERPRETER_MAX_DEPTH - 1;
+    i32 * registersEnd = interpreter->registers + INTERPRETER_MAX_REGISTERS;
+
+    const Op * op = interpreter->ops + interpreter->functions[function].entry;
+    *frame = (InterpreterFrame){ op, NULL, interpreter->registers, interpreter->functions[function].registerCount };
+    assert(frame->registerCount <= INTERPRETER_MAX_REGISTERS);
+
+    i32 * registers = frame->registers;
+    i32 returned = 0;
+    u64 executed = 0;
+    u64 calls = 0;
+    u64 nativeCalls = 0;
+    u64 promoted = 0;
+
+    #define DISPATCH() goto *op->handler
+
+    DISPATCH();
+
+value:
+    registers[op->a] = (i32) op->b;
+    op++;
+    DISPATCH();
+move:
+    registers[op->a] = registers[op->b];
+    op++;
+    DISPATCH();
+add:
+    registers[op->a] = (i32)((u32) registers[op->a] + (u32) registers[op->b]);
+    op++;
+    DISPATCH();
+result:
+    returned = registers[op->b];
+    op++;
+    DISPATCH();
+returnResult:
+    returned = registers[op->b];
+return_:
+    // there are no jumps, so every op of a function up to its return ran
+    // exactly once, calls and all
+    executed += op - frame->entry + 1;
+    if (frame == interpreter->frames) goto done;
+
+    op = frame->call;
+    frame--;
+    registers = frame->registers;
+
+    registers[op->a] = returned;
+    op++;
+    DISPATCH();
+call:
+{
+    InterpretedFunction * callee = &interpreter->functions[op->b];
+    calls++;
+
+    if (tiers != NULL)
+    {
+        NativeFunction native = tiers->native[op->b];
+        if (native == NULL && ++callee->calls >= tiers->threshold)
+        {
+            native = tiers->promote(op->b, tiers->context);
+            tiers->native[op->b] = native;
+            promoted++;
+        }
+
+        if (native != NULL)
+        {
+            nativeCalls++;
+            registers[op->a] = native();
+            op++;
+            DISPATCH();
+        }
+    }
+
+    i32 * next = registers + frame->registerCount;
+
+    if (frame == lastFrame || next + callee->registerCount > registersEnd)
+    {
+        printf("interpreter stack overflow calling '%s'\n", interpreter->functionTable[op->b].name);
+        exit(1);
+    }
+
+    frame++;
+    *frame = (InterpreterFrame){ interpreter->ops + callee->entry, op, next, callee->registerCount };
+
+    registers = next;
+    op = frame->entry;
+    DISPATCH();
+}
+
+    #undef DISPATCH
+
+done:
+    if (statistics != NULL)
+    {
+        statistics->executed += executed;
+        statistics->calls += calls;
+        statistics->nativeCalls += nativeCalls;
+        statistics->promoted += promoted;
+    }
+
+    return returned;
+}
+
+i32 interpret(const Instruction * instructions, usize instructionCount, const Symbol * functionTable, usize functionCount, const TierPolicy * tiers, InterpreterStatistics * statistics)
+{
+    Interpreter interpreter = { .functionTable = functionTable, .functionCount = functionCount };
+
+    interpreter.functions = malloc(functionCount * sizeof(InterpretedFunction));
+    assert(functionCount == 0 || interpreter.functions);
+
+    decode(&interpreter, instructions, instructionCount);
+
+    usize mainIndex = functionCount;
+    for (usize i = 0; i < functionCount; i++)
+    {
+        if (strcmp((const char *) functionTable[i].name, "main") == 0) mainIndex = i;
+    }
+
+    if (mainIndex == functionCount)
+    {
+        printf("no function 'main' to start from\n");
+        exit(1);
+    }
+
+    interpreter.frames = malloc(INTERPRETER_MAX_DEPTH * sizeof(InterpreterFrame));
+    interpreter.registers = malloc(INTERPRETER_MAX_REGISTERS * sizeof(i32));
+    assert(interpreter.frames && interpreter.registers);
+
+    u64 begin = now();
+    i32 result = execute(&interpreter, mainIndex, tiers, statistics);
+    if (statistics != NULL) statistics->nanoseconds += now() - begin;
+
+    free(interpreter.registers);
+    free(interpreter.frames);
+    free(interpreter.functions);
+    arrfree(interpreter.ops);
+
+    return result;
+}
+
+void reportInterpreter(const InterpreterStatistics * statistics)
+{
+    double seconds = statistics->nanoseconds / 1e9;
+
+    printf("interpreter: %llu ops and %llu calls in %.3f ms, %.1f M ops/s\n",
+        (unsigned long long) statistics->executed, (unsigned long long) statistics->calls,
+        seconds * 1e3, seconds != 0 ? statistics->executed / seconds / 1e6 : 0.0);
+
+    if (statistics->promoted != 0)
+    {
+        printf("interpreter: %llu functions promoted, %llu calls went to native code\n",
+            (unsigned long long) statistics->promoted, (unsigned long long) statistics->nativeCalls);
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "number.h"
+#include "compiler.h"
+
+typedef struct {
+    // dispatched, after consecutive instructions are fused
+    u64 executed;
+    u64 calls;
+    u64 nanoseconds;
+    // of the calls, the ones that went to native code
+    u64 nativeCalls;
+    u64 promoted;
+} InterpreterStatistics;
+
+// a function called with the c protocol
+typedef i32 (* NativeFunction)(void);
+
+// when the interpreter hands functions over to native code
+typedef struct {
+    // calls after which a function is promoted
+    u32              threshold;
+    // the native code of every function in the function table, NULL while it
+    // is interpreted
+    NativeFunction * native;
+    // compiles a function and returns its native code, after which every call
+    // from the interpreter goes to that instead
+    NativeFunction   (* promote)(usize function, void * context);
+    void *           context;
+} TierPolicy;
+
+// runs main of a stream produced by `compile` without lowering it to machine
+// code, returning its result like `run` does. the functions are matched with
+// `functionTable` the way `lower` does it, in order of IT_BEGIN_SCOPE.
+// unless `tiers` is NULL, hot functions are promoted to native code. unless
+// `statistics` is NULL, it is filled in as well
+i32 interpret(const Instruction * instructions, usize instructionCount, const Symbol * functionTable, usize functionCount, const TierPolicy * tiers, InterpreterStatistics * statistics);
+
+void reportInterpreter(const InterpreterStatistics * statistics);
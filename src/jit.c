@@ -0,0 +1,241 @@
+#include <stdio.h>
+
+#include "jit.h"
+#include "compiler.h"
+#include "passes.h"
+#include "target/x86_64.h"
+
+#include "assert.h"
+#include "stb_ds.h"
+
+// leaves plenty of room while keeping every call within reach of rel32
+#define LAZY_CODE_RESERVED ((usize) 1 << 30)
+
+typedef struct {
+    // the top-level declaration the function is compiled with, nested
+    // functions are compiled along with the one they are declared in
+    const Node * node;
+    u8 *         stub;
+    // NULL until the function is compiled
+    u8 *         code;
+} LazyFunction;
+
+typedef struct {
+    CodeMemory     memory;
+    LazyFunction * functions;
+    struct { char * key; usize value; } * byName;
+} LazyModule;
+
+static void declareFunctions(LazyModule * module, const Node * declaration, const Node * node)
+{
+    switch (node->type)
+    {
+        case NT_FUNC_DECL:
+        {
+            NodeFuncDecl * body = (NodeFuncDecl *) &node->body;
+
+            shput(module->byName, (char *) body->name->string, arrlenu(module->functions));
+            arrpush(module->functions, ((LazyFunction){ declaration }));
+
+            for (usize i = 0; i < body->bodyLen; i++) declareFunctions(module, declaration, body->body[i]);
+        } break;
+        case NT_NAMESPACE:
+        {
+            NodeNamespace * body = (NodeNamespace *) &node->body;
+
+            for (usize i = 0; i < body->bodyLen; i++) declareFunctions(module, declaration, body->body[i]);
+        } break;
+        default: break;
+    }
+}
+
+// called by the trampoline the first time any function of a declaration is
+static const u8 * compileOnFirstCall(u32 index, void * context)
+{
+    LazyModule * module = context;
+    assert(module->functions[index].code == NULL);
+
+    Symbol * functionTable;
+    usize functionCount;
+
+    usize instructionCount;
+    Instruction * instructions = compileFunction(module->functions[index].node, &functionTable, &functionCount, &instructionCount);
+    runPasses(&instructions, passTotals());
+    instructionCount = arrlenu(instructions);
+
+    u8 * program = NULL;
+    FunctionCode functions[functionCount];
+
+    lower(instructions, instructionCount, &program, functions);
+    layoutFunctions(&program, functions, functionCount);
+    arrfree(instructions);
+
+    u8 * code = allocateCode(&module->memory, arrlenu(program), targetOptions.functionAlignment);
+
+    usize compiled[functionCount];
+    for (usize i = 0; i < functionCount; i++)
+    {
+        compiled[i] = shget(module->byName, (char *) functionTable[i].name);
+
+        // the declaration compiles exactly the functions declareFunctions
+        // found in it, nested ones included, and none of them twice
+        assert(module->functions[compiled[i]].node == module->functions[index].node);
+        assert(module->functions[compiled[i]].code == NULL);
+        module->functions[compiled[i]].code = code + functions[i].address;
+    }
+
+    // callees that aren't compiled yet are called through their stubs
+    for (usize i = 0; i < functionCount; i++)
+    {
+        for (usize j = 0; j < arrlenu(functions[i].calls); j++)
+        {
+            CallSite call = functions[i].calls[j];
+            call.offset += functions[i].address;
+
+            i64 callee = shgeti(module->byName, (char *) call.callee);
+            if (callee < 0)
+            {
+                printf("undefined function '%s'\n", call.callee);
+                exit(1);
+            }
+
+            LazyFunction * target = &module->functions[module->byName[callee].value];
+            const u8 * address = target->code != NULL ? target->code : target->stub;
+
+            put32At(program, call.offset, (u32)(address - (code + call.offset + 4)));
+        }
+
+        arrfree(functions[i].cfi);
+        arrfree(functions[i].lines);
+        arrfree(functions[i].calls);
+    }
+
+    writeCode(&module->memory, code, program, arrlenu(program));
+    arrfree(program);
+
+    for (usize i = 0; i < functionCount; i++) nameCode(&module->memory, code + functions[i].address, functions[i].size, (const char *) functionTable[i].name);
+
+    arrfree(functionTable);
+
+    // calls already pointing at the stubs go on through them
+    for (usize i = 0; i < functionCount; i++)
+    {
+        LazyFunction * function = &module->functions[compiled[i]];
+
+        u8 jump[JUMP_SIZE];
+        buildJump(jump, function->stub, function->code);
+        writeCode(&module->memory, function->stub, jump, JUMP_SIZE);
+    }
+
+    return module->functions[index].code;
+}
+
+// declares every function of `ast` and gives it a stub, `module` has to stay
+// where it is for as long as its code is run
+static void loadLazily(LazyModule * module, const Node * ast)
+{
+    usize nodeCount;
+    const Node ** nodes = collectFunctions(ast, &nodeCount);
+    for (usize i = 0; i < nodeCount; i++) declareFunctions(module, nodes[i], nodes[i]);
+    arrfree(nodes);
+
+    usize functionCount = arrlenu(module->functions);
+    module->memory = reserveCode(LAZY_CODE_RESERVED);
+
+    // the trampoline and the stubs come first, every function is compiled after them
+    u8 * trampoline = allocateCode(&module->memory, TRAMPOLINE_SIZE, 16);
+    u8 * stubs = allocateCode(&module->memory, functionCount * STUB_SIZE, STUB_SIZE);
+
+    u8 header[TRAMPOLINE_SIZE];
+    buildTrampoline(header, compileOnFirstCall, module);
+    writeCode(&module->memory, trampoline, header, TRAMPOLINE_SIZE);
+    nameCode(&module->memory, trampoline, TRAMPOLINE_SIZE, "[lazy trampoline]");
+
+    u8 * stubCode = malloc(functionCount * STUB_SIZE);
+    assert(functionCount == 0 || stubCode);
+
+    for (usize i = 0; i < functionCount; i++)
+    {
+        module->functions[i].stub = stubs + i * STUB_SIZE;
+        buildStub(stubCode + i * STUB_SIZE, module->functions[i].stub, i, trampoline);
+    }
+    writeCode(&module->memory, stubs, stubCode, functionCount * STUB_SIZE);
+    free(stubCode);
+
+    if (functionCount != 0) nameCode(&module->memory, stubs, functionCount * STUB_SIZE, "[lazy stubs]");
+}
+
+static void unloadLazily(LazyModule * module)
+{
+    releaseCode(&module->memory);
+    arrfree(module->functions);
+    shfree(module->byName);
+}
+
+i32 runLazily(const Node * ast)
+{
+    LazyModule module = { 0 };
+    loadLazily(&module, ast);
+
+    i64 mainIndex = shgeti(module.byName, "main");
+    if (mainIndex < 0)
+    {
+        printf("no function 'main' to start from\n");
+        exit(1);
+    }
+
+    MainFunction entry = (MainFunction) module.functions[module.byName[mainIndex].value].stub;
+    i32 result = entry();
+
+    unloadLazily(&module);
+
+    return result;
+}
+
+typedef struct {
+    LazyModule module;
+    // the lazily compiled function of every interpreted one
+    usize *    lazyFunctions;
+} TieredModule;
+
+static NativeFunction promote(usize function, void * context)
+{
+    TieredModule * tiered = context;
+    LazyFunction * lazy = &tiered->module.functions[tiered->lazyFunctions[function]];
+
+    // native code may have called it already
+    if (lazy->code == NULL) compileOnFirstCall(tiered->lazyFunctions[function], &tiered->module);
+
+    return (NativeFunction) lazy->code;
+}
+
+i32 runTiered(const Node * ast, u32 threshold, InterpreterStatistics * statistics)
+{
+    // the interpreter starts right away on the stream as it is compiled, the
+    // passes are only run on the functions that get hot
+    Symbol * functionTable;
+    usize functionCount;
+
+    usize instructionCount;
+    Instruction * instructions = compile(ast, &functionTable, &functionCount, &instructionCount);
+
+    TieredModule tiered = { 0 };
+    loadLazily(&tiered.module, ast);
+
+    tiered.lazyFunctions = malloc(functionCount * sizeof(usize));
+    NativeFunction * native = calloc(functionCount, sizeof(NativeFunction));
+    assert(functionCount == 0 || (tiered.lazyFunctions && native));
+
+    for (usize i = 0; i < functionCount; i++) tiered.lazyFunctions[i] = shget(tiered.module.byName, (char *) functionTable[i].name);
+
+    TierPolicy tiers = { threshold, native, promote, &tiered };
+    i32 result = interpret(instructions, instructionCount, functionTable, functionCount, &tiers, statistics);
+
+    free(native);
+    free(tiered.lazyFunctions);
+    unloadLazily(&tiered.module);
+    arrfree(instructions);
+    arrfree(functionTable);
+
+    return result;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "number.h"
+#include "parser.h"
+#include "interpreter.h"
+
+// runs main of `ast` in this process like `runProgram`, but only compiles a
+// function once it is first called. until then its calls go to a stub that
+// compiles it and is then patched into a jump to its code
+i32 runLazily(const Node * ast);
+
+// runs main of `ast` in the interpreter, promoting every function to native
+// code compiled like by `runLazily` once it has been called `threshold` times.
+// unless `statistics` is NULL, the interpreter fills it in
+i32 runTiered(const Node * ast, u32 threshold, InterpreterStatistics * statistics);
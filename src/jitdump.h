@@ -0,0 +1,49 @@
+#ifndef JITDUMP_H_
+#define JITDUMP_H_
+
+#include <stdint.h>
+
+// the format perf inject reads code generated at runtime from, see
+// tools/perf/Documentation/jitdump-specification.txt in the linux sources
+
+#define JITDUMP_MAGIC   0x4a695444
+#define JITDUMP_VERSION 1
+
+typedef uint32_t JitdumpRecordType;
+#define JITDUMP_RECORD_CODE_LOAD 0
+#define JITDUMP_RECORD_CODE_MOVE 1
+#define JITDUMP_RECORD_DEBUG     2
+#define JITDUMP_RECORD_CLOSE     3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t arch;
+    uint32_t padding;
+    uint32_t pid;
+    // CLOCK_MONOTONIC in nanoseconds, like every other timestamp
+    uint64_t timestamp;
+    uint64_t flags;
+} JitdumpHeader;
+
+typedef struct {
+    JitdumpRecordType type;
+    // including the header
+    uint32_t          size;
+    uint64_t          timestamp;
+} JitdumpRecordHeader;
+
+// followed by the nul-terminated name and the code itself
+typedef struct {
+    JitdumpRecordHeader header;
+    uint32_t            pid;
+    uint32_t            tid;
+    uint64_t            virtualAddress;
+    uint64_t            codeAddress;
+    uint64_t            codeSize;
+    // unique per piece of code
+    uint64_t            codeIndex;
+} JitdumpCodeLoad;
+
+#endif
@@ -1,9 +1,24 @@
 #include "stdio.h"
+#include "sys/stat.h"
 
 #include "lexer.c"
 #include "parser.c"
 #include "compiler.c"
+#include "passes.c"
+#include "passes/fold.c"
+#include "passes/copyprop.c"
+#include "passes/dce.c"
+#include "passes/compact.c"
+#include "regalloc.c"
 #include "target/x86_64.c"
+#include "target/x86_64_peephole.c"
+#include "target/x86_64_object.c"
+#include "target/x86_64_executable.c"
+#include "target/x86_64_jit.c"
+#include "cache.c"
+#include "parallel.c"
+#include "jit.c"
+#include "interpreter.c"
 
 uint8_t * readFile(const char * fileName, size_t * dataSize)
 {
@@ -29,21 +44,15 @@ uint8_t * readFile(const char * fileName, size_t * dataSize)
     return data;
 }
 
-int main(void)
+static Image compileSequential(const Node * ast, const SourceFile * source)
 {
-    usize programLen;
-    u8 *  program = readFile("./test.cb", &programLen);
-
-    usize   tokenCount;
-    Token * tokens = lex(programLen, program, &tokenCount);
-
-    Node * ast = parse(tokenCount, tokens);
-
     Symbol * functionTable;
     usize functionCount;
 
     usize instructionCount;
     Instruction * instructions = compile(ast, &functionTable, &functionCount, &instructionCount);
+    runPasses(&instructions, passTotals());
+    instructionCount = arrlenu(instructions);
 
 
     /*for (usize i = 0; i < instructionCount; i++)
@@ -59,20 +68,246 @@ int main(void)
             case IT_END_SCOPE:   printf("endScope\n"); break;
             case IT_MOVE_32:     printf("move32 &%ld, &%ld\n", inst.dstSlot, inst.srcSlot); break;
             case IT_ADD_32:      printf("add32 &%ld, &%ld\n", inst.dstSlot, inst.srcSlot); break;
+            case IT_CALL_32:     printf("call32 &%ld, %s\n", inst.dstSlot, inst.callee); break;
             default:             printf("unknown\n"); break;
         }
     }
     printf("\n");*/
 
-    usize byteCount;
-    u8 * bytes = translate(instructions, instructionCount, functionTable, functionCount, &byteCount);
+    return translate(instructions, instructionCount, functionTable, functionCount, source);
+}
 
-    FILE * file = fopen("./test.o", "wb");
-    assert(file);
+static i32 runSequential(const Node * ast)
+{
+    Symbol * functionTable;
+    usize functionCount;
 
-    assert(byteCount == fwrite(bytes, 1, byteCount, file));
+    usize instructionCount;
+    Instruction * instructions = compile(ast, &functionTable, &functionCount, &instructionCount);
+    runPasses(&instructions, passTotals());
+    instructionCount = arrlenu(instructions);
 
-    fclose(file);
+    return run(instructions, instructionCount, functionTable, functionCount);
+}
+
+static i32 interpretSequential(const Node * ast, bool reportStatistics)
+{
+    Symbol * functionTable;
+    usize functionCount;
+
+    usize instructionCount;
+    Instruction * instructions = compile(ast, &functionTable, &functionCount, &instructionCount);
+    runPasses(&instructions, passTotals());
+    instructionCount = arrlenu(instructions);
+
+    InterpreterStatistics statistics = { 0 };
+    i32 result = interpret(instructions, instructionCount, functionTable, functionCount, NULL, &statistics);
+
+    if (reportStatistics) reportInterpreter(&statistics);
+
+    return result;
+}
+
+// the pass pipeline of -O1 and -O2, -O0 runs no passes and lowers slots straight
+// to the stack. the levels above it only differ in the target options set by
+// `setOptimizationLevel`, a second round of fold and copyprop finds nothing new
+static const char * optimizationPipeline = "fold,copyprop,dce,compact";
+
+static void setOptimizationLevel(usize level)
+{
+    targetOptions.packStackSlots     = level >= 1;
+    targetOptions.allocateRegisters  = level >= 2;
+    targetOptions.selectInstructions = level >= 1;
+    targetOptions.peephole           = level >= 1;
+}
+
+static void usage(const char * name)
+{
+    printf("usage: %s [-O0|-O1|-O2] [--regalloc] [-j threads] [--cache dir [--cache-stats]] [--passes pass,...] [--time-passes] [--peephole-stats] [--function-align bytes] [-g] [--function-sections] [--executable] [--run [--lazy|--tiered [--tier-threshold calls]] [--perf-map] [--jitdump]] [--interpret] [--interpreter-stats] [-o output] [input]\n", name);
+    exit(1);
+}
+
+int main(int argc, char ** argv)
+{
+    const char * inputPath  = "./test.cb";
+    const char * outputPath = NULL;
+    const char * cacheDir   = NULL;
+    bool         cacheStats = false;
+    bool         timePasses = false;
+    const char * passes     = NULL;
+    usize        optimizationLevel = 0;
+    bool         optimizationLevelGiven = false;
+    bool         regalloc   = false;
+    bool         peepholeStats = false;
+    bool         debugInfo  = false;
+    bool         executable = false;
+    bool         functionSections = false;
+    bool         run        = false;
+    bool         lazy       = false;
+    bool         perfMap    = false;
+    bool         jitdump    = false;
+    bool         interpreted = false;
+    bool         interpreterStats = false;
+    bool         tiered     = false;
+    // calls to a function before it is compiled to native code
+    u32          tierThreshold = 1000;
+
+    bool  parallel    = false;
+    // 0 picks one thread per online cpu
+    usize threadCount = 1;
+
+    registerBuiltinPasses();
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            if (++i >= argc) usage(argv[0]);
+
+            parallel    = true;
+            threadCount = strtoul(argv[i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--cache") == 0)
+        {
+            if (++i >= argc) usage(argv[0]);
+
+            cacheDir = argv[i];
+        }
+        else if (strcmp(argv[i], "--cache-stats") == 0) cacheStats = true;
+        else if (strcmp(argv[i], "--passes") == 0)
+        {
+            if (++i >= argc) usage(argv[0]);
+
+            passes = argv[i];
+        }
+        else if (strcmp(argv[i], "--time-passes") == 0) timePasses = true;
+        else if (strcmp(argv[i], "--regalloc") == 0) regalloc = true;
+        else if (strcmp(argv[i], "--peephole-stats") == 0) peepholeStats = true;
+        else if (strcmp(argv[i], "-g") == 0) debugInfo = true;
+        else if (strcmp(argv[i], "--executable") == 0) executable = true;
+        else if (strcmp(argv[i], "--function-sections") == 0) functionSections = true;
+        else if (strcmp(argv[i], "--run") == 0) run = true;
+        else if (strcmp(argv[i], "--lazy") == 0) lazy = true;
+        else if (strcmp(argv[i], "--perf-map") == 0) perfMap = true;
+        else if (strcmp(argv[i], "--jitdump") == 0) jitdump = true;
+        else if (strcmp(argv[i], "--interpret") == 0) interpreted = true;
+        else if (strcmp(argv[i], "--interpreter-stats") == 0) interpreterStats = true;
+        else if (strcmp(argv[i], "--tiered") == 0) tiered = true;
+        else if (strcmp(argv[i], "--tier-threshold") == 0)
+        {
+            if (++i >= argc) usage(argv[0]);
+
+            long threshold = strtol(argv[i], NULL, 10);
+            if (threshold <= 0 || threshold > UINT32_MAX) usage(argv[0]);
+
+            tierThreshold = threshold;
+        }
+        else if (strcmp(argv[i], "--function-align") == 0)
+        {
+            if (++i >= argc) usage(argv[0]);
+
+            long alignment = strtol(argv[i], NULL, 10);
+            if (alignment <= 0 || (alignment & (alignment - 1)) != 0) usage(argv[0]);
+
+            targetOptions.functionAlignment = alignment;
+        }
+        else if (strncmp(argv[i], "-O", 2) == 0)
+        {
+            if (strlen(argv[i]) != 3 || argv[i][2] < '0' || argv[i][2] > '2') usage(argv[0]);
+
+            optimizationLevel = argv[i][2] - '0';
+            optimizationLevelGiven = true;
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            if (++i >= argc) usage(argv[0]);
+
+            outputPath = argv[i];
+        }
+        else if (argv[i][0] == '-') usage(argv[0]);
+        else inputPath = argv[i];
+    }
+
+    // debug information refers to sections through relocations, which only
+    // objects have
+    if (executable && debugInfo) usage(argv[0]);
+    if ((lazy || tiered || perfMap || jitdump) && !run) usage(argv[0]);
+    if (lazy && tiered) usage(argv[0]);
+    if (interpreterStats && !interpreted && !tiered) usage(argv[0]);
+    if (cacheStats && cacheDir == NULL) usage(argv[0]);
+    if (run && interpreted) usage(argv[0]);
+    // nothing is written when the code is run in place
+    if ((run || interpreted) && (executable || debugInfo || outputPath != NULL || parallel || cacheDir != NULL)) usage(argv[0]);
+    if (outputPath == NULL) outputPath = executable ? "./test" : "./test.o";
+
+    // only the functions that get hot are compiled, so they might as well be
+    // optimized
+    if (tiered && !optimizationLevelGiven) optimizationLevel = 2;
+
+    // an explicit pipeline takes precedence over the one of the optimization level
+    if (passes == NULL) passes = optimizationLevel >= 1 ? optimizationPipeline : "";
+    setPipeline(passes);
+    if (timePasses) collectPassStatistics();
+    setOptimizationLevel(optimizationLevel);
+    if (regalloc) targetOptions.allocateRegisters = true;
+    targetOptions.reportPeephole = peepholeStats;
+    targetOptions.debugInfo = debugInfo;
+    targetOptions.executable = executable;
+    targetOptions.functionSections = functionSections;
+    targetOptions.jit = run;
+    targetOptions.perfMap = perfMap;
+    targetOptions.jitdump = jitdump;
+
+    usize programLen;
+    u8 *  program = readFile(inputPath, &programLen);
+
+    usize   tokenCount;
+    Token * tokens = lex(programLen, program, &tokenCount);
+
+    Node * ast = parse(tokenCount, tokens);
+
+    if (interpreted)
+    {
+        i32 result = interpretSequential(ast, interpreterStats);
+
+        if (timePasses) reportPasses();
+
+        return result;
+    }
+
+    if (run && tiered)
+    {
+        InterpreterStatistics statistics = { 0 };
+        i32 result = runTiered(ast, tierThreshold, &statistics);
+
+        if (interpreterStats) reportInterpreter(&statistics);
+        if (timePasses) reportPasses();
+
+        return result;
+    }
+
+    if (run)
+    {
+        i32 result = lazy ? runLazily(ast) : runSequential(ast);
+
+        if (timePasses) reportPasses();
+
+        // the result of main becomes the exit status, as if it had been linked
+        return result;
+    }
+
+    SourceFile source = { inputPath, program, programLen };
+
+    // caching works per function, so it always goes through the job driver
+    Image image = parallel || cacheDir != NULL
+        ? compileParallel(ast, threadCount, cacheDir, cacheStats, debugInfo ? &source : NULL)
+        : compileSequential(ast, debugInfo ? &source : NULL);
+
+    if (timePasses) reportPasses();
+
+    assert(writeImage(&image, outputPath));
+
+    if (executable) assert(chmod(outputPath, 0755) == 0);
 
     printf("finished succesfully\n");
 
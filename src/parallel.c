@@ -0,0 +1,139 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "cache.h"
+#include "passes.h"
+
+#include "assert.h"
+#include "stb_ds.h"
+
+typedef struct {
+    FunctionJob * jobs;
+    usize         jobCount;
+    atomic_size_t next;
+
+    const char *  cacheDir;
+    atomic_size_t cacheHits;
+} JobQueue;
+
+static void runJob(JobQueue * queue, FunctionJob * job)
+{
+    u64 key = 0;
+    if (queue->cacheDir != NULL)
+    {
+        key = hashFunction(job->node);
+
+        if (loadFunction(queue->cacheDir, key, job))
+        {
+            atomic_fetch_add(&queue->cacheHits, 1);
+            return;
+        }
+    }
+
+    usize instructionCount;
+    Instruction * instructions = compileFunction(job->node, &job->functionTable, &job->functionCount, &instructionCount);
+    job->passStatistics = newPassStatistics();
+    runPasses(&instructions, job->passStatistics);
+    instructionCount = arrlenu(instructions);
+
+    arrsetlen(job->functions, job->functionCount);
+
+    lower(instructions, instructionCount, &job->program, job->functions);
+
+    arrfree(instructions);
+
+    if (queue->cacheDir != NULL) storeFunction(queue->cacheDir, key, job);
+}
+
+static void * worker(void * argument)
+{
+    JobQueue * queue = argument;
+
+    for (;;)
+    {
+        usize i = atomic_fetch_add(&queue->next, 1);
+        if (i >= queue->jobCount) break;
+
+        runJob(queue, &queue->jobs[i]);
+    }
+
+    return NULL;
+}
+
+Image compileParallel(const Node * ast, usize threadCount, const char * cacheDir, bool reportCache, const SourceFile * source)
+{
+    usize nodeCount;
+    const Node ** nodes = collectFunctions(ast, &nodeCount);
+
+    // FIXME: memory leak!
+    FunctionJob * jobs = calloc(nodeCount, sizeof(FunctionJob));
+    assert(nodeCount == 0 || jobs);
+
+    for (usize i = 0; i < nodeCount; i++) jobs[i].node = nodes[i];
+    arrfree(nodes);
+
+    if (threadCount == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = cpus > 0 ? (usize) cpus : 1;
+    }
+    if (threadCount > nodeCount) threadCount = nodeCount;
+    if (threadCount == 0) threadCount = 1;
+
+    if (cacheDir != NULL) createCache(cacheDir);
+
+    JobQueue queue = { jobs, nodeCount, 0, cacheDir, 0 };
+
+    // the calling thread takes part as well
+    pthread_t threads[threadCount];
+    for (usize i = 1; i < threadCount; i++)
+    {
+        assert(pthread_create(&threads[i], NULL, worker, &queue) == 0);
+    }
+    worker(&queue);
+    for (usize i = 1; i < threadCount; i++)
+    {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+
+    if (reportCache) printf("cache: %zu of %zu functions reused\n", (usize) queue.cacheHits, nodeCount);
+
+    // concatenate in source order, rebasing every function onto its final address
+    // FIXME: memory leak!
+    u8 * program = NULL;
+    Symbol * functionTable = NULL;
+    FunctionCode * functions = NULL;
+
+    for (usize i = 0; i < nodeCount; i++)
+    {
+        FunctionJob * job = &jobs[i];
+        usize base = arrlenu(program);
+
+        for (usize j = 0; j < job->functionCount; j++)
+        {
+            arrpush(functionTable, job->functionTable[j]);
+            FunctionCode function = job->functions[j];
+            function.address += base;
+            arrpush(functions, function);
+        }
+
+        usize length = arrlenu(job->program);
+        arrsetlen(program, base + length);
+        memcpy(program + base, job->program, length);
+
+        arrfree(job->program);
+        arrfree(job->functionTable);
+        arrfree(job->functions);
+        mergePassStatistics(job->passStatistics);
+    }
+
+    if (targetOptions.reportPeephole) reportPeephole(functionTable, functions, arrlenu(functionTable));
+
+    layoutFunctions(&program, functions, arrlenu(functionTable));
+
+    if (targetOptions.executable) return emitExecutable(program, arrlenu(program), functionTable, functions, arrlenu(functionTable));
+
+    return emitObject(program, arrlenu(program), functionTable, functions, arrlenu(functionTable), source);
+}
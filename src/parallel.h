@@ -0,0 +1,27 @@
+#pragma once
+
+#include "number.h"
+#include "parser.h"
+#include "compiler.h"
+#include "passes.h"
+#include "target/x86_64.h"
+
+typedef struct {
+    const Node * node;
+
+    Symbol *     functionTable;
+    usize        functionCount;
+    // addresses are relative to the start of `program`
+    FunctionCode * functions;
+    u8 *         program;
+    // what the passes did to it, merged once every job is done
+    PassStatistics * passStatistics;
+} FunctionJob;
+
+// lowers every function in `ast` to machine code on `threadCount` threads (0
+// picks one per online cpu) and links the results into an object that is
+// bit-identical to the one produced by `compile` followed by `translate`.
+// unless `cacheDir` is NULL, functions whose code is cached there are spliced
+// in instead of being compiled again, and newly compiled ones are added to it.
+// `reportCache` prints how many were reused. `source` is passed on to `emitObject`
+Image compileParallel(const Node * ast, usize threadCount, const char * cacheDir, bool reportCache, const SourceFile * source);
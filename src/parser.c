@@ -7,7 +7,7 @@
 
 #include "stb_ds.h"
 
-#define NODE_ARENA_SIZE 1000
+#define NODE_ARENA_SIZE 65536
 
 usize         tokenCount;
 const Token * tokens;
@@ -23,7 +23,24 @@ static NodeHeader * allocNode(usize inSize)
     usize rem  = size % alignof(Node);
     usize pad  = rem == 0 ? 0 : alignof(Node) - rem;
 
-    assert(nodeArenaCursor + size <= NODE_ARENA_SIZE);
+    // oversized nodes (e.g. a namespace with many members) get a block of their own
+    if (size > NODE_ARENA_SIZE)
+    {
+        // FIXME: memory leak! free!
+        Node * node = malloc(size);
+        assert(node);
+        return node;
+    }
+
+    // nodes point at each other, so a full arena is left alone and a fresh one
+    // is started
+    if (nodeArenaCursor + size > NODE_ARENA_SIZE)
+    {
+        // FIXME: memory leak! free!
+        nodeArena       = malloc(NODE_ARENA_SIZE);
+        nodeArenaCursor = 0;
+        assert(nodeArena);
+    }
 
     Node * node = (Node *)(nodeArena + nodeArenaCursor);
     nodeArenaCursor += size + pad;
@@ -33,23 +50,27 @@ static NodeHeader * allocNode(usize inSize)
 
 static Node * parseFunctionDeclaration(void)
 {
-    const Token * attributeName  = NULL;
-    const Token * attributeValue = NULL;
+    // FIXME: memory leak!
+    Attribute * attributes = NULL;
 
     const Token * first = &tokens[cursor];
-    if (first->type == TT_AT)
+    while (cursor < tokenCount && tokens[cursor].type == TT_AT)
     {
-        assert(cursor++ < tokenCount);
+        cursor++;
 
-        attributeName = &tokens[cursor];
-        assert(cursor++ < tokenCount && attributeName->type == TT_ID);
+        Attribute attribute;
+
+        attribute.name = &tokens[cursor];
+        assert(cursor++ < tokenCount && attribute.name->type == TT_ID);
 
         assert(cursor < tokenCount && tokens[cursor++].type == TT_L_PAREN);
 
-        attributeValue = &tokens[cursor];
-        assert(cursor++ < tokenCount && attributeValue->type == TT_ID);
+        attribute.value = &tokens[cursor];
+        assert(cursor++ < tokenCount && attribute.value->type == TT_ID);
 
         assert(cursor < tokenCount && tokens[cursor++].type == TT_R_PAREN);
+
+        arrpush(attributes, attribute);
     }
 
     const Token * type = &tokens[cursor];
@@ -75,8 +96,8 @@ static Node * parseFunctionDeclaration(void)
     nodeHeader->type         = NT_FUNC_DECL;
     nodeHeader->begin        = first->begin;
     nodeHeader->length       = last->begin + last->length;
-    nodeBody->attributeName  = attributeName;
-    nodeBody->attributeValue = attributeValue;
+    nodeBody->attributes     = attributes;
+    nodeBody->attributeCount = arrlenu(attributes);
     nodeBody->returnType     = type;
     nodeBody->name           = name;
     nodeBody->bodyLen        = arrlen(body);
@@ -103,9 +124,36 @@ static Node * parseAtom(void)
     return nodeHeader;
 }
 
+static Node * parseCall(void)
+{
+    const Token * name = &tokens[cursor];
+
+    if (cursor++ >= tokenCount || name->type != TT_ID) return NULL;
+    if (cursor++ >= tokenCount || tokens[cursor - 1].type != TT_L_PAREN) return NULL;
+
+    const Token * last = &tokens[cursor];
+    assert(cursor < tokenCount && tokens[cursor++].type == TT_R_PAREN);
+
+    NodeHeader * nodeHeader = allocNode(sizeof(NodeCall));
+    NodeCall * nodeBody     = (NodeCall *) &nodeHeader->body;
+    nodeHeader->type        = NT_CALL;
+    nodeHeader->begin       = name->begin;
+    nodeHeader->length      = last->begin + last->length;
+    nodeBody->name          = name;
+
+    return nodeHeader;
+}
+
 static Node * parseExpression(void)
 {
-    Node * left = parseAtom();
+    usize  rollback = cursor;
+    Node * left     = parseCall();
+
+    if (left == NULL)
+    {
+        cursor = rollback;
+        left = parseAtom();
+    }
 
     if (tokens[cursor].type == TT_PLUS)
     {
@@ -195,7 +243,6 @@ Node * parse(usize inTokenCount, const Token * inTokens)
     tokens          = inTokens;
     cursor          = 0;
     // FIXME: memory leak! free!
-    // FIXME: allocate more arenas if memory runs out!
     nodeArena       = malloc(NODE_ARENA_SIZE);
     nodeArenaCursor = 0;
     assert(nodeArena);
@@ -274,6 +321,12 @@ void printNode(const Node * node, u32 level)
                 default:     printf("<unknown>\n");
             }
         } break;
+        case NT_CALL:
+        {
+            NodeCall * body = (NodeCall *) &node->body;
+
+            printf("CALL %s\n", body->name->string);
+        } break;
         default: printf("<UNKNOWN>\n");
     }
 }
\ No newline at end of file
@@ -11,6 +11,7 @@ typedef u16 NodeType;
 #define NT_ATOM      4
 #define NT_ADDITION  5
 #define NT_VAR_DECL  6
+#define NT_CALL      7
 
 typedef struct {
     NodeType type;
@@ -28,10 +29,16 @@ typedef struct {
     const Node *  body[];
 } NodeNamespace;
 
+// @name(value)
 typedef struct {
-    const Token * attributeName;
-    const Token * attributeValue;
-    const Token * returnType;
+    const Token * name;
+    const Token * value;
+} Attribute;
+
+typedef struct {
+    const Attribute * attributes;
+    usize             attributeCount;
+    const Token *     returnType;
     const Token * name;
     usize         bodyLen;
     const Node *  body[];
@@ -56,6 +63,11 @@ typedef struct {
     const Node *  value;
 } NodeVarDecl;
 
+// name()
+typedef struct {
+    const Token * name;
+} NodeCall;
+
 static Node * parseStatement(void);
 
 Node * parse(usize tokenCount, const Token * tokens);
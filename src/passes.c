@@ -0,0 +1,219 @@
+#include <time.h>
+
+#include "passes.h"
+
+#include "assert.h"
+#include "stb_ds.h"
+
+// FIXME: memory leak!
+static Pass *           passes   = NULL;
+static usize *          pipeline = NULL;
+static const char *     spec     = "";
+// NULL unless statistics are collected
+static PassStatistics * totals   = NULL;
+
+void registerPass(const char * name, PassFunction run)
+{
+    for (usize i = 0; i < arrlenu(passes); i++) assert(strcmp(passes[i].name, name) != 0);
+
+    arrpush(passes, ((Pass){ name, run }));
+}
+
+void registerBuiltinPasses(void)
+{
+    registerPass("fold",     passFold);
+    registerPass("copyprop", passCopyProp);
+    registerPass("dce",      passDce);
+    registerPass("compact",  passCompact);
+}
+
+void setPipeline(const char * list)
+{
+    arrfree(pipeline);
+    spec = list;
+
+    while (*list != '\0')
+    {
+        usize length = strcspn(list, ",");
+
+        bool found = false;
+        for (usize i = 0; i < arrlenu(passes); i++)
+        {
+            if (strlen(passes[i].name) == length && strncmp(passes[i].name, list, length) == 0)
+            {
+                arrpush(pipeline, i);
+                found = true;
+                break;
+            }
+        }
+
+        if (!found)
+        {
+            printf("unknown pass '%.*s'\n", (int) length, list);
+            exit(1);
+        }
+
+        list += length;
+        if (*list == ',') list++;
+    }
+}
+
+const char * pipelineSpec(void)
+{
+    return spec;
+}
+
+usize functionEnd(const Instruction * instructions, usize instructionCount, usize begin)
+{
+    assert(instructions[begin].type == IT_BEGIN_SCOPE);
+
+    for (usize i = begin + 1; i < instructionCount; i++)
+    {
+        // nested functions are compiled after the one declaring them
+        assert(instructions[i].type != IT_BEGIN_SCOPE && "function inside a function");
+
+        if (instructions[i].type == IT_END_SCOPE) return i + 1;
+    }
+
+    assert(0 && "unterminated function");
+}
+
+usize readSlots(const Instruction * instruction, usize slots[2])
+{
+    switch (instruction->type)
+    {
+        case IT_RET_MOVE_32:
+        case IT_MOVE_32:
+            slots[0] = instruction->srcSlot;
+            return 1;
+        case IT_ADD_32:
+            slots[0] = instruction->dstSlot;
+            slots[1] = instruction->srcSlot;
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+bool writesSlot(const Instruction * instruction, usize * slot)
+{
+    switch (instruction->type)
+    {
+        case IT_VALUE_32:
+        case IT_MOVE_32:
+        case IT_ADD_32:
+        case IT_CALL_32:
+            *slot = instruction->dstSlot;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static usize countSlots(const Instruction * instructions)
+{
+    usize slotCount = 0;
+
+    for (usize i = 0; i < arrlenu(instructions); i++)
+    {
+        if (instructions[i].type == IT_BEGIN_SCOPE) slotCount += instructions[i].slotCount;
+    }
+
+    return slotCount;
+}
+
+static u64 now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (u64) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static PassStatistics * allocateStatistics(void)
+{
+    // one more, so that even an empty pipeline gets something other than NULL
+    PassStatistics * statistics = calloc(arrlenu(pipeline) + 1, sizeof(PassStatistics));
+    assert(statistics);
+
+    return statistics;
+}
+
+void collectPassStatistics(void)
+{
+    assert(totals == NULL);
+    totals = allocateStatistics();
+}
+
+PassStatistics * passTotals(void)
+{
+    return totals;
+}
+
+PassStatistics * newPassStatistics(void)
+{
+    return totals != NULL ? allocateStatistics() : NULL;
+}
+
+void mergePassStatistics(PassStatistics * statistics)
+{
+    if (statistics == NULL) return;
+
+    for (usize i = 0; i < arrlenu(pipeline); i++)
+    {
+        totals[i].runs               += statistics[i].runs;
+        totals[i].nanoseconds        += statistics[i].nanoseconds;
+        totals[i].instructionsBefore += statistics[i].instructionsBefore;
+        totals[i].instructionsAfter  += statistics[i].instructionsAfter;
+        totals[i].slotsBefore        += statistics[i].slotsBefore;
+        totals[i].slotsAfter         += statistics[i].slotsAfter;
+    }
+
+    free(statistics);
+}
+
+void runPasses(Instruction ** instructions, PassStatistics * statistics)
+{
+    for (usize i = 0; i < arrlenu(pipeline); i++)
+    {
+        Pass * pass = &passes[pipeline[i]];
+
+        if (statistics == NULL)
+        {
+            pass->run(instructions);
+            continue;
+        }
+
+        usize instructionsBefore = arrlenu(*instructions);
+        usize slotsBefore        = countSlots(*instructions);
+        u64   begin              = now();
+
+        pass->run(instructions);
+
+        PassStatistics * s = &statistics[i];
+        s->runs++;
+        s->nanoseconds        += now() - begin;
+        s->instructionsBefore += instructionsBefore;
+        s->instructionsAfter  += arrlenu(*instructions);
+        s->slotsBefore        += slotsBefore;
+        s->slotsAfter         += countSlots(*instructions);
+    }
+}
+
+void reportPasses(void)
+{
+    assert(totals != NULL);
+
+    printf("%-12s %6s %12s %22s %22s\n", "pass", "runs", "time (ms)", "instructions", "slots");
+
+    // a pass that appears in the pipeline more than once gets a row per position
+    for (usize i = 0; i < arrlenu(pipeline); i++)
+    {
+        const Pass * pass = &passes[pipeline[i]];
+        const PassStatistics * s = &totals[i];
+
+        printf("%-12s %6zu %12.3f %10zu -> %-8zu %10zu -> %-8zu\n",
+            pass->name, s->runs, s->nanoseconds / 1e6,
+            s->instructionsBefore, s->instructionsAfter,
+            s->slotsBefore, s->slotsAfter);
+    }
+}
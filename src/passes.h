@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "number.h"
+#include "compiler.h"
+
+// a pass rewrites a stream produced by `compile` (an stb_ds array) in place;
+// the stream may hold one or more functions, each delimited by IT_BEGIN_SCOPE
+// and IT_END_SCOPE
+typedef void (* PassFunction)(Instruction ** instructions);
+
+// what one position of the pipeline did, over every stream it was run on
+typedef struct {
+    usize runs;
+    u64   nanoseconds;
+    usize instructionsBefore;
+    usize instructionsAfter;
+    usize slotsBefore;
+    usize slotsAfter;
+} PassStatistics;
+
+typedef struct {
+    const char * name;
+    PassFunction run;
+} Pass;
+
+void registerPass(const char * name, PassFunction run);
+void registerBuiltinPasses(void);
+
+// parses a comma-separated list of pass names into the pipeline run by `runPasses`
+void setPipeline(const char * list);
+
+// the list last given to `setPipeline`, part of the key of cached functions
+const char * pipelineSpec(void);
+
+// makes `reportPasses` report on the pipeline, which has to be set by now
+void collectPassStatistics(void);
+// the statistics `reportPasses` reports, one per position of the pipeline, or
+// NULL unless they are collected. only for use from a single thread
+PassStatistics * passTotals(void);
+// like `passTotals`, but private to the caller and zeroed
+PassStatistics * newPassStatistics(void);
+// adds `statistics` from `newPassStatistics` to the totals and frees it
+void mergePassStatistics(PassStatistics * statistics);
+
+// runs the pipeline over `instructions` and adds to `statistics` unless it is
+// NULL, may be called from several threads as long as they don't share it
+void runPasses(Instruction ** instructions, PassStatistics * statistics);
+
+void reportPasses(void);
+
+// returns the index one past the IT_END_SCOPE closing the function that begins at `begin`
+usize functionEnd(const Instruction * instructions, usize instructionCount, usize begin);
+
+// stores the slots `instruction` reads in `slots` and returns how many there are
+usize readSlots(const Instruction * instruction, usize slots[2]);
+// returns whether `instruction` writes a slot and stores it in `slot`
+bool writesSlot(const Instruction * instruction, usize * slot);
+
+// removes instructions whose result is never read
+void passDce(Instruction ** instructions);
+// replaces arithmetic on known constants with IT_VALUE_32
+void passFold(Instruction ** instructions);
+// makes reads of a copied slot read the original instead
+void passCopyProp(Instruction ** instructions);
+// renumbers the slots of every function densely in order of first use
+void passCompact(Instruction ** instructions);
@@ -0,0 +1,63 @@
+#include "passes.h"
+
+#include "assert.h"
+#include "stb_ds.h"
+
+#define SLOT_UNUSED ((usize) -1)
+
+static void renumber(usize * slot, usize * numbers, usize * slotCount)
+{
+    if (numbers[*slot] == SLOT_UNUSED) numbers[*slot] = (*slotCount)++;
+
+    *slot = numbers[*slot];
+}
+
+void passCompact(Instruction ** instructions)
+{
+    Instruction * is = *instructions;
+    usize count = arrlenu(is);
+
+    for (usize begin = 0; begin < count;)
+    {
+        if (is[begin].type != IT_BEGIN_SCOPE)
+        {
+            begin++;
+            continue;
+        }
+
+        usize end = functionEnd(is, count, begin);
+
+        // FIXME: memory leak!
+        usize * numbers = malloc((is[begin].slotCount + 1) * sizeof(usize));
+        assert(numbers);
+        for (usize i = 0; i < is[begin].slotCount; i++) numbers[i] = SLOT_UNUSED;
+
+        usize slotCount = 0;
+
+        for (usize i = begin; i < end; i++)
+        {
+            switch (is[i].type)
+            {
+                case IT_VALUE_32:
+                case IT_CALL_32:
+                    renumber(&is[i].dstSlot, numbers, &slotCount);
+                    break;
+                case IT_RET_MOVE_32:
+                    renumber(&is[i].srcSlot, numbers, &slotCount);
+                    break;
+                case IT_MOVE_32:
+                case IT_ADD_32:
+                    // the source is read first
+                    renumber(&is[i].srcSlot, numbers, &slotCount);
+                    renumber(&is[i].dstSlot, numbers, &slotCount);
+                    break;
+                default: break;
+            }
+        }
+
+        is[begin].slotCount = slotCount;
+        free(numbers);
+
+        begin = end;
+    }
+}
@@ -0,0 +1,86 @@
+#include "passes.h"
+
+#include "assert.h"
+#include "stb_ds.h"
+
+#define SLOT_NONE ((usize) -1)
+
+void passCopyProp(Instruction ** instructions)
+{
+    Instruction * is = *instructions;
+    usize count = arrlenu(is);
+
+    for (usize begin = 0; begin < count;)
+    {
+        if (is[begin].type != IT_BEGIN_SCOPE)
+        {
+            begin++;
+            continue;
+        }
+
+        usize end = functionEnd(is, count, begin);
+        usize slotCount = is[begin].slotCount;
+
+        // copies[s] is the slot s currently holds a copy of. the slots copying
+        // the same one are linked through next and previous, starting at copiers
+        // of it, so that a write only invalidates the copies of what it writes
+        // FIXME: memory leak!
+        usize * copies   = malloc((slotCount + 1) * sizeof(usize));
+        usize * copiers  = malloc((slotCount + 1) * sizeof(usize));
+        usize * next     = malloc((slotCount + 1) * sizeof(usize));
+        usize * previous = malloc((slotCount + 1) * sizeof(usize));
+        assert(copies && copiers && next && previous);
+        for (usize i = 0; i <= slotCount; i++) copies[i] = copiers[i] = SLOT_NONE;
+
+        for (usize i = begin; i < end; i++)
+        {
+            Instruction * instruction = &is[i];
+
+            // only sources are rewritten, IT_ADD_32 updates its destination in place
+            switch (instruction->type)
+            {
+                case IT_RET_MOVE_32:
+                case IT_MOVE_32:
+                case IT_ADD_32:
+                    if (copies[instruction->srcSlot] != SLOT_NONE) instruction->srcSlot = copies[instruction->srcSlot];
+                    break;
+                default: break;
+            }
+
+            usize slot;
+            if (!writesSlot(instruction, &slot)) continue;
+
+            // the slot no longer holds a copy
+            if (copies[slot] != SLOT_NONE)
+            {
+                if (previous[slot] != SLOT_NONE) next[previous[slot]] = next[slot];
+                else copiers[copies[slot]] = next[slot];
+                if (next[slot] != SLOT_NONE) previous[next[slot]] = previous[slot];
+
+                copies[slot] = SLOT_NONE;
+            }
+
+            // and neither does any slot copying it
+            for (usize j = copiers[slot]; j != SLOT_NONE; j = next[j]) copies[j] = SLOT_NONE;
+            copiers[slot] = SLOT_NONE;
+
+            if (instruction->type == IT_MOVE_32 && instruction->srcSlot != slot)
+            {
+                usize source = instruction->srcSlot;
+
+                copies[slot]   = source;
+                previous[slot] = SLOT_NONE;
+                next[slot]     = copiers[source];
+                if (copiers[source] != SLOT_NONE) previous[copiers[source]] = slot;
+                copiers[source] = slot;
+            }
+        }
+
+        free(previous);
+        free(next);
+        free(copiers);
+        free(copies);
+
+        begin = end;
+    }
+}
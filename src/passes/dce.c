@@ -0,0 +1,62 @@
+#include "passes.h"
+
+#include "assert.h"
+#include "stb_ds.h"
+
+void passDce(Instruction ** instructions)
+{
+    Instruction * is = *instructions;
+    usize count = arrlenu(is);
+    usize kept  = 0;
+
+    for (usize begin = 0; begin < count;)
+    {
+        if (is[begin].type != IT_BEGIN_SCOPE)
+        {
+            is[kept++] = is[begin++];
+            continue;
+        }
+
+        usize end = functionEnd(is, count, begin);
+
+        // FIXME: memory leak!
+        bool * live = calloc(is[begin].slotCount + 1, sizeof(bool));
+        bool * dead = calloc(end - begin, sizeof(bool));
+        assert(live && dead);
+
+        // straight-line code, so a single backwards walk finds every dead write
+        for (usize i = end; i-- > begin;)
+        {
+            usize slot;
+            if (writesSlot(&is[i], &slot))
+            {
+                assert(slot < is[begin].slotCount);
+
+                // a callee may have effects beyond its result
+                if (!live[slot] && is[i].type != IT_CALL_32)
+                {
+                    dead[i - begin] = true;
+                    continue;
+                }
+
+                live[slot] = false;
+            }
+
+            usize reads[2];
+            usize readCount = readSlots(&is[i], reads);
+            for (usize j = 0; j < readCount; j++) live[reads[j]] = true;
+        }
+
+        for (usize i = begin; i < end; i++)
+        {
+            if (!dead[i - begin]) is[kept++] = is[i];
+        }
+
+        free(live);
+        free(dead);
+
+        begin = end;
+    }
+
+    arrsetlen(*instructions, kept);
+}
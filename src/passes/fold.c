@@ -0,0 +1,67 @@
+#include "passes.h"
+
+#include "assert.h"
+#include "stb_ds.h"
+
+void passFold(Instruction ** instructions)
+{
+    Instruction * is = *instructions;
+    usize count = arrlenu(is);
+
+    for (usize begin = 0; begin < count;)
+    {
+        if (is[begin].type != IT_BEGIN_SCOPE)
+        {
+            begin++;
+            continue;
+        }
+
+        usize end = functionEnd(is, count, begin);
+
+        // FIXME: memory leak!
+        bool * known  = calloc(is[begin].slotCount + 1, sizeof(bool));
+        u32 *  values = calloc(is[begin].slotCount + 1, sizeof(u32));
+        assert(known && values);
+
+        for (usize i = begin; i < end; i++)
+        {
+            Instruction * instruction = &is[i];
+
+            switch (instruction->type)
+            {
+                case IT_VALUE_32:
+                {
+                    known[instruction->dstSlot]  = true;
+                    values[instruction->dstSlot] = instruction->srcValue32;
+                } break;
+                case IT_MOVE_32:
+                {
+                    known[instruction->dstSlot] = known[instruction->srcSlot];
+                    if (!known[instruction->srcSlot]) break;
+
+                    values[instruction->dstSlot] = values[instruction->srcSlot];
+                    *instruction = (Instruction){ IT_VALUE_32, .dstSlot = instruction->dstSlot, .srcValue32 = values[instruction->srcSlot], .sourceOffset = instruction->sourceOffset };
+                } break;
+                case IT_ADD_32:
+                {
+                    if (!known[instruction->dstSlot] || !known[instruction->srcSlot])
+                    {
+                        known[instruction->dstSlot] = false;
+                        break;
+                    }
+
+                    // i32 addition wraps like the machine instruction does
+                    values[instruction->dstSlot] += values[instruction->srcSlot];
+                    *instruction = (Instruction){ IT_VALUE_32, .dstSlot = instruction->dstSlot, .srcValue32 = values[instruction->dstSlot], .sourceOffset = instruction->sourceOffset };
+                } break;
+                case IT_CALL_32: known[instruction->dstSlot] = false; break;
+                default: break;
+            }
+        }
+
+        free(known);
+        free(values);
+
+        begin = end;
+    }
+}
@@ -0,0 +1,231 @@
+#include "regalloc.h"
+#include "passes.h"
+
+#include "assert.h"
+#include "stb_ds.h"
+
+#define SLOT_UNSEEN ((usize) -1)
+
+static void touch(usize slot, usize i, usize * starts, Interval ** intervals)
+{
+    if (starts[slot] == SLOT_UNSEEN)
+    {
+        starts[slot] = arrlenu(*intervals);
+        arrpush(*intervals, ((Interval){ slot, i, i }));
+    }
+    else (*intervals)[starts[slot]].end = i;
+}
+
+Interval * computeIntervals(const Instruction * instructions, usize begin, usize end)
+{
+    assert(instructions[begin].type == IT_BEGIN_SCOPE);
+    usize slotCount = instructions[begin].slotCount;
+
+    // FIXME: memory leak!
+    Interval * intervals = NULL;
+
+    // index of each slot's interval
+    usize * indices = malloc((slotCount + 1) * sizeof(usize));
+    assert(indices);
+    for (usize i = 0; i < slotCount; i++) indices[i] = SLOT_UNSEEN;
+
+    for (usize i = begin; i < end; i++)
+    {
+        usize reads[2];
+        usize readCount = readSlots(&instructions[i], reads);
+        for (usize j = 0; j < readCount; j++) touch(reads[j], i, indices, &intervals);
+
+        usize slot;
+        if (writesSlot(&instructions[i], &slot)) touch(slot, i, indices, &intervals);
+    }
+
+    free(indices);
+
+    return intervals;
+}
+
+// whether a call happens while `interval` holds its value. the one writing it
+// happens before and the last one reading it can't read a result
+static bool crossesCall(Interval interval, const usize * calls)
+{
+    for (usize i = 0; i < arrlenu(calls); i++)
+    {
+        if (interval.start < calls[i] && calls[i] < interval.end) return true;
+    }
+
+    return false;
+}
+
+u8 * allocateRegisters(const Instruction * instructions, usize begin, usize end, usize registerCount, usize callerSavedCount)
+{
+    usize slotCount = instructions[begin].slotCount;
+
+    // FIXME: memory leak!
+    u8 * registers = malloc(slotCount + 1);
+    assert(registers);
+    memset(registers, REGISTER_NONE, slotCount + 1);
+
+    Interval * intervals = computeIntervals(instructions, begin, end);
+
+    usize * calls = NULL;
+    for (usize i = begin; i < end; i++)
+    {
+        if (instructions[i].type == IT_CALL_32) arrpush(calls, i);
+    }
+
+    // intervals currently holding a register, ordered by end
+    Interval * active = NULL;
+    bool available[registerCount];
+    for (usize i = 0; i < registerCount; i++) available[i] = true;
+
+    for (usize i = 0; i < arrlenu(intervals); i++)
+    {
+        Interval current = intervals[i];
+        usize first = crossesCall(current, calls) ? callerSavedCount : 0;
+
+        // an interval ending where the current one starts is only read there,
+        // before the current one is written, so its register can be reused
+        usize expired = 0;
+        while (expired < arrlenu(active) && active[expired].end <= current.start)
+        {
+            available[registers[active[expired].slot]] = true;
+            expired++;
+        }
+        if (expired > 0) arrdeln(active, 0, expired);
+
+        usize r = first;
+        while (r < registerCount && !available[r]) r++;
+
+        if (r == registerCount)
+        {
+            // spill whichever lives longest of those holding a register this
+            // interval may take
+            usize last = arrlenu(active);
+            while (last > 0 && registers[active[last - 1].slot] < first) last--;
+
+            if (last == 0 || active[last - 1].end <= current.end) continue;
+
+            r = registers[active[last - 1].slot];
+            registers[active[last - 1].slot] = REGISTER_NONE;
+            arrdel(active, last - 1);
+        }
+
+        available[r] = false;
+        registers[current.slot] = r;
+
+        // keep `active` ordered by end
+        arrpush(active, current);
+        for (usize at = arrlenu(active) - 1; at > 0 && active[at - 1].end > current.end; at--)
+        {
+            active[at]     = active[at - 1];
+            active[at - 1] = current;
+        }
+    }
+
+    arrfree(active);
+    arrfree(intervals);
+    arrfree(calls);
+
+    return registers;
+}
+
+// the width in bytes of the value `instruction` writes
+static usize slotWidth(const Instruction * instruction)
+{
+    switch (instruction->type)
+    {
+        case IT_VALUE_32:
+        case IT_MOVE_32:
+        case IT_ADD_32:
+        case IT_CALL_32:
+            return 4;
+        default:
+            assert(0 && "TODO:");
+    }
+}
+
+// widths are powers of two up to 8, freed space is kept per width
+#define WIDTH_CLASSES 4
+
+static usize widthClass(usize width)
+{
+    switch (width)
+    {
+        case 1: return 0;
+        case 2: return 1;
+        case 4: return 2;
+        case 8: return 3;
+        default: assert(0 && "TODO:");
+    }
+}
+
+usize * packStackSlots(const Instruction * instructions, usize begin, usize end, const u8 * registers, usize * frameSize)
+{
+    usize slotCount = instructions[begin].slotCount;
+
+    // FIXME: memory leak!
+    usize * offsets = calloc(slotCount + 1, sizeof(usize));
+    usize * widths  = calloc(slotCount + 1, sizeof(usize));
+    assert(offsets && widths);
+
+    for (usize i = begin; i < end; i++)
+    {
+        usize slot;
+        if (writesSlot(&instructions[i], &slot) && widths[slot] == 0) widths[slot] = slotWidth(&instructions[i]);
+    }
+
+    Interval * intervals = computeIntervals(instructions, begin, end);
+
+    // intervals currently holding memory, ordered by end
+    Interval * active = NULL;
+    usize * available[WIDTH_CLASSES] = { 0 };
+    usize size = 0;
+
+    for (usize i = 0; i < arrlenu(intervals); i++)
+    {
+        Interval current = intervals[i];
+        if (registers != NULL && registers[current.slot] != REGISTER_NONE) continue;
+
+        // same reuse rule as for registers, see `allocateRegisters`
+        usize expired = 0;
+        while (expired < arrlenu(active) && active[expired].end <= current.start)
+        {
+            usize slot = active[expired].slot;
+            arrpush(available[widthClass(widths[slot])], offsets[slot]);
+            expired++;
+        }
+        if (expired > 0) arrdeln(active, 0, expired);
+
+        usize width = widths[current.slot];
+        assert(width != 0 && "slot read before it is written");
+
+        usize ** freed = &available[widthClass(width)];
+        if (arrlenu(*freed) > 0)
+        {
+            offsets[current.slot] = (*freed)[arrlenu(*freed) - 1];
+            arrsetlen(*freed, arrlenu(*freed) - 1);
+        }
+        else
+        {
+            // TODO: split wider freed space for narrower values once there are any
+            size = (size + width - 1) & ~(width - 1);
+            offsets[current.slot] = size;
+            size += width;
+        }
+
+        arrpush(active, current);
+        for (usize at = arrlenu(active) - 1; at > 0 && active[at - 1].end > current.end; at--)
+        {
+            active[at]     = active[at - 1];
+            active[at - 1] = current;
+        }
+    }
+
+    arrfree(active);
+    arrfree(intervals);
+    for (usize i = 0; i < WIDTH_CLASSES; i++) arrfree(available[i]);
+    free(widths);
+
+    *frameSize = size;
+    return offsets;
+}
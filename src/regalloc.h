@@ -0,0 +1,30 @@
+#pragma once
+
+#include "number.h"
+#include "compiler.h"
+
+#define REGISTER_NONE 0xff
+
+// the instructions during which a slot holds a value, as indices into the
+// function's stream; straight-line code, so first touch to last touch
+typedef struct {
+    usize slot;
+    usize start;
+    usize end;
+} Interval;
+
+// returns the live interval of every slot the function in [begin, end) uses,
+// ordered by start
+Interval * computeIntervals(const Instruction * instructions, usize begin, usize end);
+
+// linear scan: returns, for each slot of the function in [begin, end), an
+// index below `registerCount` or REGISTER_NONE if the slot has to live in memory.
+// the first `callerSavedCount` registers don't survive IT_CALL_32, so slots
+// live across a call never get one of them
+u8 * allocateRegisters(const Instruction * instructions, usize begin, usize end, usize registerCount, usize callerSavedCount);
+
+// assigns every slot of the function in [begin, end) that `registers` leaves in
+// memory (all of them if `registers` is NULL) a byte offset into the frame.
+// slots whose intervals don't overlap share space, and each slot is aligned to
+// its width. returns the offsets and stores the size of the frame in `frameSize`
+usize * packStackSlots(const Instruction * instructions, usize begin, usize end, const u8 * registers, usize * frameSize);
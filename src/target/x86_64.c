@@ -1,257 +1,971 @@
-#include <stdalign.h>
-
 #include "number.h"
 #include "stb_ds.h"
-#include "elf.h"
+#include "dwarf.h"
 
 #include "compiler.h"
+#include "passes.h"
+#include "regalloc.h"
+#include "target/x86_64.h"
+
+TargetOptions targetOptions = { .functionAlignment = 16 };
 
 typedef u8 Protocol;
 #define PROTO_OPTIMAL 0
 #define PROTO_CDECL   1
 #define PROTO_MAIN    2
 
-static void mov_vrsp_d8_i32(u8 ** bytes, i8 d, u32 i)
+// rax is kept free as a scratch register for memory-to-memory operations;
+// caller-saved registers come first
+static const Register allocatableRegisters[] = {
+    REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_R8,  REG_R9,  REG_R10,
+    REG_R11, REG_RBX, REG_RBP, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+static inline bool isI8(i32 i)
 {
-    u8 * imm = (u8 *) &i;
-    arrpush(*bytes, 0xc7);
-    arrpush(*bytes, 0x44);
-    arrpush(*bytes, 0x24);
-    arrpush(*bytes, d);
-    arrpush(*bytes, imm[0]);
-    arrpush(*bytes, imm[1]);
-    arrpush(*bytes, imm[2]);
-    arrpush(*bytes, imm[3]);
+    return -128 <= i && i <= 127;
 }
 
-static void mov_edi_vrsp_d8(u8 ** bytes, i8 d)
+// the longest x86 instruction
+#define MAX_INSTRUCTION_LENGTH 15
+
+typedef u8 EncodingFlags;
+#define ENC_VALID     0x01
+// 64-bit operand size
+#define ENC_REX_W     0x02
+// the register operand is added to the opcode, there's no ModRM byte
+#define ENC_PLUS_REG  0x04
+// ModRM.reg holds `extension` instead of a register operand
+#define ENC_EXTENSION 0x08
+// preceded by the 0x0f escape
+#define ENC_TWO_BYTE  0x10
+// the immediate is a 32-bit displacement from the end of the instruction,
+// there's no ModRM byte
+#define ENC_REL32     0x20
+
+typedef struct {
+    EncodingFlags flags;
+    u8            opcode;
+    // used instead of `opcode` when the immediate fits in a signed byte, 0 if
+    // there is no such form
+    u8            opcodeImm8;
+    // used instead of `opcode` when the destination is eax, 0 if there is no
+    // such form
+    u8            opcodeAccumulator;
+    u8            extension;
+} Encoding;
+
+#define R OPERAND_REGISTER
+#define I OPERAND_IMMEDIATE
+#define M OPERAND_MEMORY
+#define N OPERAND_NONE
+
+// indexed by operation, destination kind and source kind. register-to-register
+// forms put the source in ModRM.reg, forms with a memory operand put the
+// register operand there
+static const Encoding encodings[][4][4] = {
+    [MO_MOV] = {
+        [R][R] = { ENC_VALID,                 0x89 },
+        [R][I] = { ENC_VALID | ENC_PLUS_REG,  0xb8 },
+        [R][M] = { ENC_VALID,                 0x8b },
+        [M][R] = { ENC_VALID,                 0x89 },
+        [M][I] = { ENC_VALID | ENC_EXTENSION, 0xc7, .extension = 0 },
+    },
+    [MO_ADD] = {
+        [R][R] = { ENC_VALID,                 0x01 },
+        [R][I] = { ENC_VALID | ENC_EXTENSION, 0x81, 0x83, 0x05, 0 },
+        [R][M] = { ENC_VALID,                 0x03 },
+        [M][R] = { ENC_VALID,                 0x01 },
+        [M][I] = { ENC_VALID | ENC_EXTENSION, 0x81, 0x83, .extension = 0 },
+    },
+    [MO_XOR] = {
+        [R][R] = { ENC_VALID,                 0x31 },
+    },
+    [MO_LEA] = {
+        [R][M] = { ENC_VALID,                 0x8d },
+    },
+    [MO_PUSH] = {
+        [N][R] = { ENC_VALID | ENC_PLUS_REG,  0x50 },
+    },
+    [MO_POP] = {
+        [R][N] = { ENC_VALID | ENC_PLUS_REG,  0x58 },
+    },
+    [MO_SUB_RSP] = {
+        [R][I] = { ENC_VALID | ENC_REX_W | ENC_EXTENSION, 0x81, 0x83, .extension = 5 },
+    },
+    [MO_ADD_RSP] = {
+        [R][I] = { ENC_VALID | ENC_REX_W | ENC_EXTENSION, 0x81, 0x83, .extension = 0 },
+    },
+    [MO_RET] = {
+        [N][N] = { ENC_VALID,                 0xc3 },
+    },
+    [MO_SYSCALL] = {
+        [N][N] = { ENC_VALID | ENC_TWO_BYTE,  0x05 },
+    },
+    [MO_CALL] = {
+        [N][I] = { ENC_VALID | ENC_REL32,     0xe8 },
+    },
+    [MO_JMP] = {
+        [N][I] = { ENC_VALID | ENC_REL32,     0xe9 },
+    },
+};
+
+#undef R
+#undef I
+#undef M
+#undef N
+
+static inline u8 * put32(u8 * out, u32 i)
 {
-    arrpush(*bytes, 0x8b);
-    arrpush(*bytes, 0x7c);
-    arrpush(*bytes, 0x24);
-    arrpush(*bytes, d);
+    memcpy(out, &i, sizeof(i));
+    return out + sizeof(i);
 }
 
-static void mov_eax_i32(u8 ** bytes, u32 i)
+// writes `mi` to `out`, which has room for MAX_INSTRUCTION_LENGTH bytes, and
+// returns how many bytes it took
+static usize encodeInto(u8 * out, const MachineInstruction * mi)
 {
-    u8 * imm = (u8 *) &i;
-    arrpush(*bytes, 0xb8);
-    arrpush(*bytes, imm[0]);
-    arrpush(*bytes, imm[1]);
-    arrpush(*bytes, imm[2]);
-    arrpush(*bytes, imm[3]);
+    assert(mi->op < sizeof(encodings) / sizeof(encodings[0]));
+
+    const Encoding * encoding = &encodings[mi->op][mi->dst.kind][mi->src.kind];
+    assert((encoding->flags & ENC_VALID) && "invalid operands");
+
+    // the operands by their role in the encoding
+    Register reg = REG_NONE, rm = REG_NONE;
+    const Operand * memory = NULL;
+    const Operand * immediate = NULL;
+
+    if (mi->dst.kind == OPERAND_MEMORY)       { memory = &mi->dst; if (mi->src.kind == OPERAND_REGISTER) reg = mi->src.reg; }
+    else if (mi->src.kind == OPERAND_MEMORY)  { memory = &mi->src; reg = mi->dst.reg; }
+    else if (mi->dst.kind == OPERAND_REGISTER && mi->src.kind == OPERAND_REGISTER) { reg = mi->src.reg; rm = mi->dst.reg; }
+    else if (mi->dst.kind == OPERAND_REGISTER) rm = mi->dst.reg;
+    else if (mi->src.kind == OPERAND_REGISTER) rm = mi->src.reg;
+
+    if (mi->src.kind == OPERAND_IMMEDIATE) immediate = &mi->src;
+
+    u8 opcode = encoding->opcode;
+    bool imm8 = false, accumulator = false;
+
+    if (immediate != NULL)
+    {
+        if (encoding->opcodeImm8 != 0 && isI8(immediate->immediate)) { opcode = encoding->opcodeImm8; imm8 = true; }
+        else if (encoding->opcodeAccumulator != 0 && memory == NULL && rm == REG_RAX) { opcode = encoding->opcodeAccumulator; accumulator = true; }
+    }
+
+    if (encoding->flags & ENC_EXTENSION) reg = encoding->extension;
+
+    bool operands = mi->dst.kind != OPERAND_NONE || mi->src.kind != OPERAND_NONE;
+    bool modrm = operands && !(encoding->flags & (ENC_PLUS_REG | ENC_REL32)) && !accumulator;
+
+    Register base  = memory != NULL ? memory->base  : rm;
+    Register index = memory != NULL ? memory->index : REG_NONE;
+
+    u8 * begin = out;
+
+    u8 prefix = 0x40 | ((encoding->flags & ENC_REX_W) != 0) << 3
+              | (modrm && reg   != REG_NONE && reg   >= 8) << 2
+              | (index != REG_NONE && index >= 8) << 1
+              | (base  != REG_NONE && base  >= 8);
+    if (prefix != 0x40) *out++ = prefix;
+
+    if (encoding->flags & ENC_TWO_BYTE) *out++ = 0x0f;
+
+    if (encoding->flags & ENC_PLUS_REG) *out++ = opcode | (rm & 7);
+    else *out++ = opcode;
+
+    if (modrm && memory == NULL)
+    {
+        *out++ = 0xc0 | (reg & 7) << 3 | (rm & 7);
+    }
+    else if (modrm)
+    {
+        assert(index != REG_RSP);
+
+        i32 displacement = memory->displacement;
+
+        // rbp and r13 can't be a base without a displacement
+        u8 mod = displacement == 0 && (base & 7) != REG_RBP ? 0x00
+               : isI8(displacement)                       ? 0x40
+               :                                            0x80;
+
+        // rsp and r12 can only be a base through a SIB byte
+        if (index == REG_NONE && (base & 7) != REG_RSP)
+        {
+            *out++ = mod | (reg & 7) << 3 | (base & 7);
+        }
+        else
+        {
+            *out++ = mod | (reg & 7) << 3 | 0x04;
+            *out++ = (index == REG_NONE ? 0x04 : (index & 7)) << 3 | (base & 7);
+        }
+
+        if (mod == 0x40) *out++ = (u8) displacement;
+        else if (mod == 0x80) out = put32(out, displacement);
+    }
+
+    if (immediate != NULL)
+    {
+        if (imm8) *out++ = (u8) immediate->immediate;
+        else out = put32(out, immediate->immediate);
+    }
+
+    return out - begin;
 }
 
-static void mov_eax_vrsp_d8(u8 ** bytes, i8 d)
+static usize encodedLength(const MachineInstruction * mi)
 {
-    arrpush(*bytes, 0x8b);
-    arrpush(*bytes, 0x44);
-    arrpush(*bytes, 0x24);
-    arrpush(*bytes, d);
+    u8 scratch[MAX_INSTRUCTION_LENGTH];
+    return encodeInto(scratch, mi);
 }
 
-static void mov_vrsp_d8_eax(u8 ** bytes, i8 d)
+// dwarf register numbers, indexed by Register
+static const u8 dwarfRegisters[] = { 0, 2, 1, 3, 7, 6, 4, 5, 8, 9, 10, 11, 12, 13, 14, 15 };
+
+typedef struct {
+    // code offset the call frame instructions so far describe
+    usize location;
+    // distance from the stack pointer to the canonical frame address
+    i64   cfaOffset;
+    // the offset remembered before an epilogue that isn't the last one
+    i64   rememberedOffset;
+    bool  inEpilogue;
+    bool  remembered;
+} FrameState;
+
+static void pushUleb(u8 ** bytes, u64 value)
 {
-    arrpush(*bytes, 0x89);
-    arrpush(*bytes, 0x44);
-    arrpush(*bytes, 0x24);
-    arrpush(*bytes, d);
+    do
+    {
+        u8 byte = value & 0x7f;
+        value >>= 7;
+        arrpush(*bytes, value != 0 ? byte | 0x80 : byte);
+    } while (value != 0);
 }
 
-static void add_vrsp_d8_eax(u8 ** bytes, i8 d)
+static void advanceFrame(u8 ** cfi, FrameState * state, usize location)
 {
-    arrpush(*bytes, 0x01);
-    arrpush(*bytes, 0x44);
-    arrpush(*bytes, 0x24);
-    arrpush(*bytes, d);
+    usize delta = location - state->location;
+    state->location = location;
+
+    if (delta == 0) return;
+
+    if (delta < 0x40) arrpush(*cfi, DWARF_CFA_ADVANCE_LOC | delta);
+    else if (delta <= 0xff)
+    {
+        arrpush(*cfi, DWARF_CFA_ADVANCE_LOC1);
+        arrpush(*cfi, delta);
+    }
+    else if (delta <= 0xffff)
+    {
+        arrpush(*cfi, DWARF_CFA_ADVANCE_LOC2);
+        arrpush(*cfi, delta);
+        arrpush(*cfi, delta >> 8);
+    }
+    else
+    {
+        arrpush(*cfi, DWARF_CFA_ADVANCE_LOC4);
+        for (usize i = 0; i < 4; i++) arrpush(*cfi, delta >> (i * 8));
+    }
 }
 
-static void syscall(u8 ** bytes)
+static void defineCfaOffset(u8 ** cfi, FrameState * state, usize location)
 {
-    arrpush(*bytes, 0x0f);
-    arrpush(*bytes, 0x05);
+    advanceFrame(cfi, state, location);
+    arrpush(*cfi, DWARF_CFA_DEF_CFA_OFFSET);
+    pushUleb(cfi, state->cfaOffset);
 }
 
-static void push_rbp(u8 ** bytes)
+// describes the effect of `code[i]`, which ends at `end`, on the stack pointer
+static void describeFrame(u8 ** cfi, FrameState * state, const MachineInstruction * code, usize count, usize i, usize end)
 {
-    arrpush(*bytes, 0x55);
+    MachineInstruction mi = code[i];
+
+    if ((mi.op == MO_ADD_RSP || mi.op == MO_POP) && !state->inEpilogue)
+    {
+        state->inEpilogue = true;
+
+        // code after this epilogue runs with the frame still set up
+        usize ret = i;
+        while (ret < count && code[ret].op != MO_RET) ret++;
+
+        if (ret + 1 < count)
+        {
+            arrpush(*cfi, DWARF_CFA_REMEMBER_STATE);
+            state->rememberedOffset = state->cfaOffset;
+            state->remembered = true;
+        }
+    }
+
+    switch (mi.op)
+    {
+        case MO_PUSH:
+        {
+            state->cfaOffset += 8;
+            defineCfaOffset(cfi, state, end);
+            arrpush(*cfi, DWARF_CFA_OFFSET | dwarfRegisters[mi.src.reg]);
+            pushUleb(cfi, state->cfaOffset / 8);
+        } break;
+        case MO_POP:
+        {
+            state->cfaOffset -= 8;
+            defineCfaOffset(cfi, state, end);
+        } break;
+        case MO_SUB_RSP:
+        {
+            state->cfaOffset += mi.src.immediate;
+            defineCfaOffset(cfi, state, end);
+        } break;
+        case MO_ADD_RSP:
+        {
+            state->cfaOffset -= mi.src.immediate;
+            defineCfaOffset(cfi, state, end);
+        } break;
+        case MO_RET:
+        {
+            if (state->remembered)
+            {
+                advanceFrame(cfi, state, end);
+                arrpush(*cfi, DWARF_CFA_RESTORE_STATE);
+                state->cfaOffset = state->rememberedOffset;
+                state->remembered = false;
+            }
+
+            state->inEpilogue = false;
+        } break;
+        default: break;
+    }
 }
 
-static void push_rbx(u8 ** bytes)
+// appends the `count` instructions of `function` to `*bytes` with a single
+// capacity check. call frame instructions for every change to the stack
+// pointer are appended to its cfi, a mapping for every change of source to its
+// lines when debug information is on, and its calls get their offsets
+static void encode(u8 ** bytes, const MachineInstruction * code, usize count, FunctionCode * function)
 {
-    arrpush(*bytes, 0x53);
+    usize length = arrlenu(*bytes);
+    if (arrcap(*bytes) < length + count * MAX_INSTRUCTION_LENGTH) arrsetcap(*bytes, length + count * MAX_INSTRUCTION_LENGTH);
+
+    u8 * begin = *bytes + length;
+    u8 * out = begin;
+    FrameState state = { .cfaOffset = 8 };
+
+    for (usize i = 0; i < count; i++)
+    {
+        if (targetOptions.debugInfo && (arrlenu(function->lines) == 0 || arrlast(function->lines).sourceOffset != code[i].sourceOffset))
+        {
+            arrpush(function->lines, ((LineMapping){ out - begin, code[i].sourceOffset }));
+        }
+
+        out += encodeInto(out, &code[i]);
+        describeFrame(&function->cfi, &state, code, count, i, out - begin);
+
+        if (code[i].op == MO_CALL)
+        {
+            // filled in once every function has its address
+            function->calls[code[i].src.immediate].offset = out - begin - 4;
+            put32(out - 4, 0);
+        }
+    }
+
+    stbds_header(*bytes)->length = out - *bytes;
 }
 
-static void push_r12(u8 ** bytes)
+Protocol resolveProtocol(u8 * string)
 {
-    arrpush(*bytes, 0x41);
-    arrpush(*bytes, 0x54);
+    if (strcmp((char *) string, "optimal") == 0)
+        return PROTO_OPTIMAL;
+    else if (strcmp((char *) string, "default") == 0 || strcmp((char *) string, "c") == 0 || strcmp((char *) string, "cdecl") == 0)
+        return PROTO_CDECL;
+    else if (strcmp((char *) string, "main") == 0)
+        return targetOptions.jit ? PROTO_CDECL : PROTO_MAIN;
+    else
+        assert(0);
 }
 
-static void push_r13(u8 ** bytes)
+// the red zone below rsp a leaf function may use without adjusting rsp
+#define RED_ZONE_SIZE 128
+
+static inline Operand reg(Register r)
 {
-    arrpush(*bytes, 0x41);
-    arrpush(*bytes, 0x55);
+    return (Operand){ OPERAND_REGISTER, .reg = r };
 }
 
-static void push_r14(u8 ** bytes)
+static inline Operand imm(i32 i)
 {
-    arrpush(*bytes, 0x41);
-    arrpush(*bytes, 0x56);
+    return (Operand){ OPERAND_IMMEDIATE, .immediate = i };
 }
 
-static void push_r15(u8 ** bytes)
+static inline Operand vrsp(i64 d)
 {
-    arrpush(*bytes, 0x41);
-    arrpush(*bytes, 0x57);
+    assert(INT32_MIN <= d && d <= INT32_MAX);
+
+    return (Operand){ OPERAND_MEMORY, .base = REG_RSP, .index = REG_NONE, .displacement = (i32) d };
 }
 
-static void ret(u8 ** bytes)
+bool sameOperand(Operand a, Operand b)
 {
-    arrpush(*bytes, 0xc3);
+    if (a.kind != b.kind) return false;
+
+    switch (a.kind)
+    {
+        case OPERAND_NONE:      return true;
+        case OPERAND_REGISTER:  return a.reg == b.reg;
+        case OPERAND_IMMEDIATE: return a.immediate == b.immediate;
+        case OPERAND_MEMORY:    return a.base == b.base && a.index == b.index && a.displacement == b.displacement;
+        default:                assert(0);
+    }
 }
 
-static void pop_r15(u8 ** bytes)
+static void emit(MachineInstruction ** code, MachineOp op, Operand dst, Operand src)
 {
-    arrpush(*bytes, 0x41);
-    arrpush(*bytes, 0x5f);
+    arrpush(*code, ((MachineInstruction){ op, dst, src }));
 }
 
-static void pop_r14(u8 ** bytes)
+typedef struct {
+    // relative to the top of the frame; 0 marks a slot that hasn't been written
+    // yet, every allocated one is below the top
+    i64 * slots;
+    u8 *  registers;
+    usize slotCount;
+    i64   stackPointer;
+    // the size of the frame rsp is lowered by, 0 when it fits in the red zone
+    i64   frameSize;
+} Frame;
+
+// where a slot lives: a register, or else memory relative to rsp
+static Operand defineSlot(Frame * frame, usize slot)
 {
-    arrpush(*bytes, 0x41);
-    arrpush(*bytes, 0x5e);
+    assert(slot < frame->slotCount);
+
+    if (frame->registers != NULL && frame->registers[slot] != REGISTER_NONE)
+        return reg(allocatableRegisters[frame->registers[slot]]);
+
+    if (frame->slots[slot] == 0)
+    {
+        frame->stackPointer -= 4;
+        frame->slots[slot] = frame->stackPointer;
+    }
+
+    return vrsp(frame->frameSize + frame->slots[slot]);
 }
 
-static void pop_r13(u8 ** bytes)
+static Operand useSlot(Frame * frame, usize slot)
 {
-    arrpush(*bytes, 0x41);
-    arrpush(*bytes, 0x5d);
+    assert(slot < frame->slotCount);
+
+    if (frame->registers != NULL && frame->registers[slot] != REGISTER_NONE)
+        return reg(allocatableRegisters[frame->registers[slot]]);
+
+    assert(frame->slots[slot] != 0);
+
+    return vrsp(frame->frameSize + frame->slots[slot]);
 }
 
-static void pop_r12(u8 ** bytes)
+// callee-saved registers, in the order the cdecl prologue pushes them
+static const Register savedRegisters[] = { REG_RBP, REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15 };
+
+// wraps `code` in pushes and pops of the callee-saved registers it writes
+static void preserveRegisters(MachineInstruction ** code)
 {
-    arrpush(*bytes, 0x41);
-    arrpush(*bytes, 0x5c);
+    u16 written = 0;
+    bool calls = false;
+
+    for (usize i = 0; i < arrlenu(*code); i++)
+    {
+        MachineInstruction mi = (*code)[i];
+        if (mi.dst.kind == OPERAND_REGISTER && mi.op != MO_SUB_RSP && mi.op != MO_ADD_RSP) written |= 1 << mi.dst.reg;
+        if (mi.op == MO_CALL) calls = true;
+    }
+
+    Register saved[sizeof(savedRegisters) / sizeof(savedRegisters[0])];
+    usize savedCount = 0;
+
+    for (usize r = 0; r < sizeof(savedRegisters) / sizeof(savedRegisters[0]); r++)
+    {
+        if ((written >> savedRegisters[r]) & 1) saved[savedCount++] = savedRegisters[r];
+    }
+
+    // the frame is a multiple of 16 bytes and the return address misaligns
+    // the stack by 8, so an even number of pushes needs padding for calls to
+    // be made with rsp 16-byte aligned
+    bool padded = calls && savedCount % 2 == 0;
+
+    if (savedCount == 0 && !padded) return;
+
+    MachineInstruction * wrapped = NULL;
+
+    // the prologue belongs to the source of the first instruction, every
+    // epilogue to the one of its ret
+    usize entryOffset = arrlenu(*code) != 0 ? (*code)[0].sourceOffset : 0;
+    for (usize r = 0; r < savedCount; r++) arrpush(wrapped, ((MachineInstruction){ MO_PUSH, .src = reg(saved[r]), .sourceOffset = entryOffset }));
+    if (padded) arrpush(wrapped, ((MachineInstruction){ MO_SUB_RSP, reg(REG_RSP), imm(8), .sourceOffset = entryOffset }));
+
+    for (usize i = 0; i < arrlenu(*code); i++)
+    {
+        if ((*code)[i].op == MO_RET)
+        {
+            usize sourceOffset = (*code)[i].sourceOffset;
+            if (padded) arrpush(wrapped, ((MachineInstruction){ MO_ADD_RSP, reg(REG_RSP), imm(8), .sourceOffset = sourceOffset }));
+            for (usize r = savedCount; r-- > 0;) arrpush(wrapped, ((MachineInstruction){ MO_POP, .dst = reg(saved[r]), .sourceOffset = sourceOffset }));
+        }
+
+        arrpush(wrapped, (*code)[i]);
+    }
+
+    arrfree(*code);
+    *code = wrapped;
 }
 
-static void pop_rbx(u8 ** bytes)
+static void encodeFunction(u8 ** program, MachineInstruction ** code, FunctionCode * function, bool cdecl)
 {
-    arrpush(*bytes, 0x5b);
+    if (targetOptions.peephole)
+    {
+        usize before = 0;
+
+        if (targetOptions.reportPeephole)
+        {
+            for (usize i = 0; i < arrlenu(*code); i++) before += encodedLength(&(*code)[i]);
+        }
+
+        peephole(code);
+
+        if (targetOptions.reportPeephole)
+        {
+            usize after = 0;
+            for (usize i = 0; i < arrlenu(*code); i++) after += encodedLength(&(*code)[i]);
+            function->peepholeSaved = before - after;
+        }
+    }
+
+    // only known once the peephole optimizer is done with the body
+    if (cdecl) preserveRegisters(code);
+
+    encode(program, *code, arrlenu(*code), function);
+
+    if (*code != NULL) stbds_header(*code)->length = 0;
 }
 
-static void pop_rbp(u8 ** bytes)
+// instruction selection over expression trees. every IR expression is a tree
+// of additions over constants and slots, and since 32-bit addition wraps it
+// flattens into a sum of one constant and any number of slots. definitions
+// are deferred until their value is needed, so that a slot read only once is
+// folded into the tree of its reader instead of being written and read back,
+// and a tree is then covered by lea, add with an immediate or memory operand,
+// and plain moves
+
+typedef struct {
+    i32     constant;
+    usize * slots;
+} Sum;
+
+typedef struct {
+    Frame *              frame;
+    MachineInstruction ** code;
+
+    // per slot, the value of a definition that hasn't been emitted yet
+    Sum *   sums;
+    bool *  deferred;
+    usize * deferredSlots;
+    // per slot, how many reads of its current definition are left
+    usize * reads;
+    // per instruction of the function, how many times the slot it writes is
+    // read before it is written again
+    usize * readsOfDefinition;
+    usize   begin;
+} Selector;
+
+static void beginSelection(Selector * selector, Frame * frame, MachineInstruction ** code, const Instruction * instructions, usize begin, usize end)
 {
-    arrpush(*bytes, 0x5d);
+    *selector = (Selector){ .frame = frame, .code = code, .begin = begin };
+
+    selector->sums              = calloc(frame->slotCount + 1, sizeof(selector->sums[0]));
+    selector->deferred          = calloc(frame->slotCount + 1, sizeof(selector->deferred[0]));
+    selector->reads             = calloc(frame->slotCount + 1, sizeof(selector->reads[0]));
+    selector->readsOfDefinition = calloc(end - begin, sizeof(selector->readsOfDefinition[0]));
+    assert(selector->sums && selector->deferred && selector->reads && selector->readsOfDefinition);
+
+    // count backwards, a definition ends the reads of the one before it
+    usize * pending = calloc(frame->slotCount + 1, sizeof(pending[0]));
+    assert(pending);
+
+    for (usize i = end; i-- > begin;)
+    {
+        usize slot;
+        if (writesSlot(&instructions[i], &slot))
+        {
+            selector->readsOfDefinition[i - begin] = pending[slot];
+            pending[slot] = 0;
+        }
+
+        usize slots[2];
+        usize readCount = readSlots(&instructions[i], slots);
+        for (usize j = 0; j < readCount; j++) pending[slots[j]]++;
+    }
+
+    free(pending);
 }
 
-usize addString(char ** stringTable, const char * string)
+static void endSelection(Selector * selector)
 {
-    usize stringLen = strlen(string) + 1;
-    usize offset = arrlenu(*stringTable);
-    arrsetlen(*stringTable, offset + stringLen);
-    memcpy(*stringTable + offset, string, stringLen);
-    return offset;
+    // whatever is still deferred is never read
+    for (usize slot = 0; slot < selector->frame->slotCount; slot++) arrfree(selector->sums[slot].slots);
+
+    arrfree(selector->deferredSlots);
+    free(selector->sums);
+    free(selector->deferred);
+    free(selector->reads);
+    free(selector->readsOfDefinition);
 }
 
-usize addSymbol(Elf64Symbol ** symbolTable, Elf64Symbol symbol)
+static void selectSum(Selector * selector, Operand dst, Sum sum);
+
+// computes `sum` in rax, which never holds a slot, and moves it to `dst`
+static void selectThroughRax(Selector * selector, Operand dst, Sum sum)
 {
-    usize offset = arrlenu(*symbolTable) * sizeof(Elf64Symbol);
-    arrpush(*symbolTable, symbol);
-    return offset;
+    selectSum(selector, reg(REG_RAX), sum);
+    emit(selector->code, MO_MOV, dst, reg(REG_RAX));
 }
 
-Protocol resolveProtocol(u8 * string)
+// emits the shortest sequence this selector knows for `dst = sum`
+static void selectSum(Selector * selector, Operand dst, Sum sum)
 {
-    if (strcmp((char *) string, "optimal") == 0)
-        return PROTO_OPTIMAL;
-    else if (strcmp((char *) string, "default") == 0 || strcmp((char *) string, "c") == 0 || strcmp((char *) string, "cdecl") == 0)
-        return PROTO_CDECL;
-    else if (strcmp((char *) string, "main") == 0)
-        return PROTO_MAIN;
+    usize count = arrlenu(sum.slots);
+
+    Operand * terms = NULL;
+    usize occurrences = 0;
+    for (usize i = 0; i < count; i++)
+    {
+        Operand term = useSlot(selector->frame, sum.slots[i]);
+        if (sameOperand(term, dst)) occurrences++;
+        else arrpush(terms, term);
+    }
+
+    // dst would be overwritten while it's still being read
+    if (occurrences > 1) { arrfree(terms); selectThroughRax(selector, dst, sum); return; }
+
+    usize termCount = arrlenu(terms);
+    bool constantUsed = sum.constant == 0;
+
+    if (dst.kind == OPERAND_REGISTER)
+    {
+        usize next = 0;
+
+        if (occurrences == 0)
+        {
+            // lea r, [a + b + c] or lea r, [a + c] when the terms allow it
+            Operand address = { OPERAND_MEMORY, .base = REG_NONE, .index = REG_NONE, .displacement = sum.constant };
+
+            for (usize i = 0; i < termCount && i < 2 && terms[i].kind == OPERAND_REGISTER; i++)
+            {
+                if (i == 0) address.base  = terms[i].reg;
+                else        address.index = terms[i].reg;
+            }
+
+            if (address.base != REG_NONE && (address.index != REG_NONE || !constantUsed))
+            {
+                emit(selector->code, MO_LEA, dst, address);
+                next = address.index != REG_NONE ? 2 : 1;
+                constantUsed = true;
+            }
+            else if (termCount == 0)
+            {
+                emit(selector->code, MO_MOV, dst, imm(sum.constant));
+                constantUsed = true;
+            }
+            else
+            {
+                emit(selector->code, MO_MOV, dst, terms[0]);
+                next = 1;
+            }
+        }
+
+        for (usize i = next; i < termCount; i++) emit(selector->code, MO_ADD, dst, terms[i]);
+        if (!constantUsed) emit(selector->code, MO_ADD, dst, imm(sum.constant));
+    }
     else
-        assert(0);
+    {
+        assert(dst.kind == OPERAND_MEMORY);
+
+        bool registersOnly = true;
+        for (usize i = 0; i < termCount; i++) registersOnly &= terms[i].kind == OPERAND_REGISTER;
+
+        if (occurrences == 0 && termCount == 0)
+        {
+            emit(selector->code, MO_MOV, dst, imm(sum.constant));
+        }
+        else if (occurrences == 0 && termCount == 1 && registersOnly && constantUsed)
+        {
+            emit(selector->code, MO_MOV, dst, terms[0]);
+        }
+        else if (occurrences == 1 && registersOnly)
+        {
+            // add [m], r and add [m], imm in place
+            for (usize i = 0; i < termCount; i++) emit(selector->code, MO_ADD, dst, terms[i]);
+            if (!constantUsed) emit(selector->code, MO_ADD, dst, imm(sum.constant));
+        }
+        else if (occurrences == 1)
+        {
+            // the rest of the sum in rax, then a single add to memory
+            Sum rest = { sum.constant, NULL };
+            for (usize i = 0; i < count; i++)
+            {
+                if (!sameOperand(useSlot(selector->frame, sum.slots[i]), dst)) arrpush(rest.slots, sum.slots[i]);
+            }
+
+            selectSum(selector, reg(REG_RAX), rest);
+            emit(selector->code, MO_ADD, dst, reg(REG_RAX));
+            arrfree(rest.slots);
+        }
+        else selectThroughRax(selector, dst, sum);
+    }
+
+    arrfree(terms);
 }
 
-u8 * translate(const Instruction * instructions, usize instructionCount, Symbol * functionTable, usize functionCount, usize * byteCount)
+static bool readsLocation(Selector * selector, Sum sum, Operand location)
 {
-    // FIXME: memory leak!
-    u8 * program = NULL;
+    for (usize i = 0; i < arrlenu(sum.slots); i++)
+    {
+        if (sameOperand(useSlot(selector->frame, sum.slots[i]), location)) return true;
+    }
 
-    i8 stackPointer = 0;
+    return false;
+}
 
-    usize slotCount = 0;
-    usize allocatedSlots = 0;
-    // TODO: this should be i64!
-    i8 * slots = NULL;
+static void undefer(Selector * selector, usize slot)
+{
+    assert(selector->deferred[slot]);
+    selector->deferred[slot] = false;
+
+    for (usize i = 0; i < arrlenu(selector->deferredSlots); i++)
+    {
+        if (selector->deferredSlots[i] != slot) continue;
+
+        arrdel(selector->deferredSlots, i);
+        return;
+    }
+}
+
+// emits the deferred definition of `slot`
+static void materialize(Selector * selector, usize slot)
+{
+    undefer(selector, slot);
+
+    selectSum(selector, defineSlot(selector->frame, slot), selector->sums[slot]);
+
+    arrfree(selector->sums[slot].slots);
+}
+
+// the value of `slot` for one of its reads
+static Sum takeSlot(Selector * selector, usize slot)
+{
+    assert(selector->reads[slot] > 0);
+    selector->reads[slot]--;
 
+    if (selector->deferred[slot])
+    {
+        // the only read left, the definition folds into the reader
+        if (selector->reads[slot] == 0)
+        {
+            undefer(selector, slot);
+
+            Sum sum = selector->sums[slot];
+            selector->sums[slot] = (Sum){ 0 };
+            return sum;
+        }
+
+        materialize(selector, slot);
+    }
+
+    Sum sum = { 0 };
+    arrpush(sum.slots, slot);
+    return sum;
+}
+
+static void defineSum(Selector * selector, usize slot, usize instruction, Sum sum)
+{
+    assert(!selector->deferred[slot]);
+
+    selector->reads[slot] = selector->readsOfDefinition[instruction - selector->begin];
+
+    // a definition nobody reads is dropped
+    if (selector->reads[slot] == 0)
+    {
+        arrfree(sum.slots);
+        return;
+    }
+
+    // slots whose lifetimes end here may share a location with this one, so
+    // deferred definitions still reading it are emitted while it holds what
+    // they expect. those never have to wait for anything deferred themselves
+    Operand location = defineSlot(selector->frame, slot);
+
+    for (usize i = 0; i < arrlenu(selector->deferredSlots);)
+    {
+        usize other = selector->deferredSlots[i];
+
+        if (readsLocation(selector, selector->sums[other], location)) materialize(selector, other);
+        else i++;
+    }
+
+    selector->sums[slot] = sum;
+    selector->deferred[slot] = true;
+    arrpush(selector->deferredSlots, slot);
+}
+
+// emits every deferred definition, before something that may observe the
+// locations of slots
+static void flushSelection(Selector * selector)
+{
+    while (arrlenu(selector->deferredSlots) != 0) materialize(selector, selector->deferredSlots[0]);
+}
+
+static Sum addSums(Sum a, Sum b)
+{
+    a.constant = (i32)((u32) a.constant + (u32) b.constant);
+    for (usize i = 0; i < arrlenu(b.slots); i++) arrpush(a.slots, b.slots[i]);
+    arrfree(b.slots);
+    return a;
+}
+
+static void stampSource(MachineInstruction * code, usize first, usize sourceOffset)
+{
+    for (usize i = first; i < arrlenu(code); i++) code[i].sourceOffset = sourceOffset;
+}
+
+// lowers `instructions` to machine code appended to `*program`, storing the
+// address of every function it begins in `functions`
+void lower(const Instruction * instructions, usize instructionCount, u8 ** program, FunctionCode * functions)
+{
+    Frame frame = { 0 };
+
+    // the machine code of the current function
+    MachineInstruction * code = NULL;
     usize currentFunction = 0;
-    u64 functionAddresses[functionCount];
+    bool cdecl = false;
+    Selector selector = { 0 };
 
     for (usize i = 0; i < instructionCount; i++)
     {
         Instruction instruction = instructions[i];
+        usize firstEmitted = arrlenu(code);
 
         switch (instruction.type)
         {
             case IT_BEGIN_SCOPE:
             {
-                functionAddresses[currentFunction++] = arrlenu(program);
+                functions[currentFunction++] = (FunctionCode){ arrlenu(*program) };
+                cdecl = false;
 
-                slotCount = instruction.slotCount;
-                allocatedSlots = 0;
-                stackPointer = 0;
+                frame.slotCount = instruction.slotCount;
+                frame.stackPointer = 0;
                 // FIXME: memory leak!
-                slots = malloc(slotCount * sizeof(slots[0]));
-                assert(slots);
+                frame.slots = calloc(frame.slotCount + 1, sizeof(frame.slots[0]));
+                assert(frame.slots);
+
+                usize end = 0;
+                if (targetOptions.allocateRegisters || targetOptions.packStackSlots || targetOptions.selectInstructions) end = functionEnd(instructions, instructionCount, i);
+
+                frame.registers = NULL;
+                if (targetOptions.allocateRegisters)
+                {
+                    usize callerSavedCount = 0;
+                    while (callerSavedCount < sizeof(allocatableRegisters) / sizeof(allocatableRegisters[0]) && ((CALLER_SAVED_REGISTERS >> allocatableRegisters[callerSavedCount]) & 1)) callerSavedCount++;
+
+                    frame.registers = allocateRegisters(instructions, i, end, sizeof(allocatableRegisters) / sizeof(allocatableRegisters[0]), callerSavedCount);
+                }
+
+                // unpacked slots are handed out as they are written, at most 4 bytes each
+                usize frameSize = 4 * frame.slotCount;
+
+                if (targetOptions.packStackSlots)
+                {
+                    usize * offsets = packStackSlots(instructions, i, end, frame.registers, &frameSize);
+
+                    // the frame lies below its top, so every packed slot ends up at a non-zero offset
+                    for (usize slot = 0; slot < frame.slotCount; slot++)
+                    {
+                        if (frame.registers == NULL || frame.registers[slot] == REGISTER_NONE) frame.slots[slot] = (i64) offsets[slot] - (i64) frameSize;
+                    }
+
+                    free(offsets);
+                }
+
+                assert(frameSize <= INT32_MAX - 15);
+
+                // a call would push its return address into the red zone
+                bool calls = false;
+                for (usize j = i + 1; j < instructionCount && instructions[j].type != IT_END_SCOPE; j++)
+                {
+                    if (instructions[j].type == IT_CALL_32) calls = true;
+                }
+
+                // small frames live in the red zone, larger ones are allocated by
+                // the prologue and keep rsp 16-byte aligned relative to entry
+                frame.frameSize = frameSize <= RED_ZONE_SIZE && !calls ? 0 : (i64)((frameSize + 15) & ~(usize) 15);
+
+                if (targetOptions.selectInstructions) beginSelection(&selector, &frame, &code, instructions, i, end);
+            } break;
+            case IT_END_SCOPE:
+            {
+                if (targetOptions.selectInstructions) endSelection(&selector);
+                stampSource(code, firstEmitted, instruction.sourceOffset);
+
+                encodeFunction(program, &code, &functions[currentFunction - 1], cdecl);
+
+                functions[currentFunction - 1].size = arrlenu(*program) - functions[currentFunction - 1].address;
             } break;
-            case IT_END_SCOPE: break;
             case IT_VALUE_32:
             {
-                if (instruction.dstSlot >= allocatedSlots)
+                if (targetOptions.selectInstructions)
                 {
-                    assert(instruction.dstSlot == allocatedSlots);
-
-                    allocatedSlots++;
-                    stackPointer -= 4;
-                    slots[instruction.dstSlot] = stackPointer;
+                    defineSum(&selector, instruction.dstSlot, i, (Sum){ (i32) instruction.srcValue32, NULL });
+                    break;
                 }
 
-                mov_vrsp_d8_i32(&program, stackPointer, instruction.srcValue32);
+                emit(&code, MO_MOV, defineSlot(&frame, instruction.dstSlot), imm(instruction.srcValue32));
             } break;
             case IT_FUNC_BEGIN:
             {
+                functions[currentFunction - 1].layout  = instruction.layout;
+                functions[currentFunction - 1].linkage = instruction.linkage;
+
                 switch (resolveProtocol(instruction.jmpProtocol))
                 {
                     case PROTO_MAIN:
                         // FIXME: follow abi
+                        functions[currentFunction - 1].exits = true;
                         break;
                     case PROTO_CDECL:
-                    {
                         // FIXME: exactly follow https://gitlab.com/x86-psABIs/x86-64-ABI (§3.2)
-                        push_rbp(&program);
-                        push_rbx(&program);
-                        push_r12(&program);
-                        push_r13(&program);
-                        push_r14(&program);
-                        push_r15(&program);
-                    } break;
+                        // callee-saved registers are pushed once the body is final
+                        cdecl = true;
+                        break;
                     default: assert(0 && "TODO:");
                 }
+
+                if (frame.frameSize != 0) emit(&code, MO_SUB_RSP, reg(REG_RSP), imm(frame.frameSize));
             } break;
             case IT_RET_MOVE_32:
             {
-                assert(instruction.srcSlot < allocatedSlots);
-
+                Register target;
                 switch (resolveProtocol(instruction.movProtocol))
                 {
-                    case PROTO_MAIN:
-                        mov_edi_vrsp_d8(&program, slots[instruction.srcSlot]); break;
-                    case PROTO_CDECL:
-                        mov_eax_vrsp_d8(&program, slots[instruction.srcSlot]); break;
-                    default:
-                        assert(0 && "TODO:");
+                    case PROTO_MAIN:  target = REG_RDI; break;
+                    case PROTO_CDECL: target = REG_RAX; break;
+                    default:          assert(0 && "TODO:");
+                }
+
+                if (targetOptions.selectInstructions)
+                {
+                    Sum sum = takeSlot(&selector, instruction.srcSlot);
+                    selectSum(&selector, reg(target), sum);
+                    arrfree(sum.slots);
+                    break;
                 }
+
+                Operand src = useSlot(&frame, instruction.srcSlot);
+                if (!sameOperand(src, reg(target))) emit(&code, MO_MOV, reg(target), src);
             } break;
             case IT_RETURN:
             {
@@ -260,182 +974,189 @@ u8 * translate(const Instruction * instructions, usize instructionCount, Symbol
                     case PROTO_MAIN:
                     {
                         // FIXME: follow abi
-                        mov_eax_i32(&program, 0x3c);
-                        syscall(&program);
+                        emit(&code, MO_MOV, reg(REG_RAX), imm(0x3c));
+                        emit(&code, MO_SYSCALL, (Operand){ 0 }, (Operand){ 0 });
                     } break;
                     case PROTO_CDECL:
                     {
                         // FIXME: exactly follow https://gitlab.com/x86-psABIs/x86-64-ABI (§3.2)
-                        pop_r15(&program);
-                        pop_r14(&program);
-                        pop_r13(&program);
-                        pop_r12(&program);
-                        pop_rbx(&program);
-                        pop_rbp(&program);
-                        ret(&program);
+                        if (frame.frameSize != 0) emit(&code, MO_ADD_RSP, reg(REG_RSP), imm(frame.frameSize));
+
+                        emit(&code, MO_RET, (Operand){ 0 }, (Operand){ 0 });
                     } break;
                     default: assert(0 && "TODO:");
                 }
             } break;
             case IT_MOVE_32:
             {
-                assert(instruction.srcSlot < allocatedSlots);
-
-                if (instruction.dstSlot >= allocatedSlots)
+                if (targetOptions.selectInstructions)
                 {
-                    assert(instruction.dstSlot == allocatedSlots);
+                    defineSum(&selector, instruction.dstSlot, i, takeSlot(&selector, instruction.srcSlot));
+                    break;
+                }
+
+                Operand src = useSlot(&frame, instruction.srcSlot);
+                Operand dst = defineSlot(&frame, instruction.dstSlot);
 
-                    allocatedSlots++;
-                    stackPointer -= 4;
-                    slots[instruction.dstSlot] = stackPointer;
+                if (sameOperand(src, dst)) break;
+
+                if (src.kind == OPERAND_MEMORY && dst.kind == OPERAND_MEMORY)
+                {
+                    emit(&code, MO_MOV, reg(REG_RAX), src);
+                    src = reg(REG_RAX);
                 }
 
-                mov_eax_vrsp_d8(&program, slots[instruction.srcSlot]);
-                mov_vrsp_d8_eax(&program, slots[instruction.dstSlot]);
+                emit(&code, MO_MOV, dst, src);
             } break;
             case IT_ADD_32:
             {
-                assert(instruction.srcSlot < allocatedSlots);
-                assert(instruction.dstSlot < allocatedSlots);
+                if (targetOptions.selectInstructions)
+                {
+                    Sum sum = takeSlot(&selector, instruction.dstSlot);
+                    sum = addSums(sum, takeSlot(&selector, instruction.srcSlot));
+                    defineSum(&selector, instruction.dstSlot, i, sum);
+                    break;
+                }
+
+                Operand src = useSlot(&frame, instruction.srcSlot);
+                Operand dst = useSlot(&frame, instruction.dstSlot);
+
+                if (src.kind == OPERAND_MEMORY && dst.kind == OPERAND_MEMORY)
+                {
+                    emit(&code, MO_MOV, reg(REG_RAX), src);
+                    src = reg(REG_RAX);
+                }
+
+                emit(&code, MO_ADD, dst, src);
+            } break;
+            case IT_CALL_32:
+            {
+                // the callee may clobber any caller-saved register, deferred
+                // definitions are emitted while their slots still hold them
+                if (targetOptions.selectInstructions) flushSelection(&selector);
+
+                FunctionCode * function = &functions[currentFunction - 1];
+                arrpush(function->calls, ((CallSite){ 0, instruction.callee }));
+                emit(&code, MO_CALL, (Operand){ 0 }, imm(arrlenu(function->calls) - 1));
+
+                if (targetOptions.selectInstructions)
+                {
+                    selector.reads[instruction.dstSlot] = selector.readsOfDefinition[i - selector.begin];
+                    if (selector.reads[instruction.dstSlot] == 0) break;
+                }
 
-                mov_eax_vrsp_d8(&program, slots[instruction.srcSlot]);
-                add_vrsp_d8_eax(&program, slots[instruction.dstSlot]);
+                emit(&code, MO_MOV, defineSlot(&frame, instruction.dstSlot), reg(REG_RAX));
             } break;
             default: assert(0 && "TODO:");
         }
+
+        // whatever the instruction caused to be emitted, including deferred
+        // definitions it forced, is attributed to it
+        stampSource(code, firstEmitted, instruction.sourceOffset);
     }
 
-    char * stringTable = NULL;
+    arrfree(code);
+}
 
-    usize nullString = addString(&stringTable, "");
-    usize strtabName = addString(&stringTable, ".strtab");
-    usize symtabName = addString(&stringTable, ".symtab");
-    usize textName   = addString(&stringTable, ".text");
+// the recommended multi-byte nops, by length
+static const u8 nops[9][9] = {
+    { 0x90 },
+    { 0x66, 0x90 },
+    { 0x0f, 0x1f, 0x00 },
+    { 0x0f, 0x1f, 0x40, 0x00 },
+    { 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+    { 0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+    { 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00 },
+    { 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+};
 
-    usize functionNames[functionCount];
-    for (usize i = 0; i < functionCount; i++)
+static void nopPadding(u8 * out, usize length)
+{
+    while (length > 0)
     {
-        functionNames[i] = addString(&stringTable, (char *) functionTable[i].name);
+        usize chunk = length < 9 ? length : 9;
+        memcpy(out, nops[chunk - 1], chunk);
+        out += chunk;
+        length -= chunk;
     }
+}
 
-    Elf64Symbol * symbolTable = NULL;
+void layoutFunctions(u8 ** program, FunctionCode * functions, usize functionCount)
+{
+    usize alignment = targetOptions.functionAlignment;
+    assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
 
-    addSymbol(&symbolTable, (Elf64Symbol)
+    // FIXME: memory leak!
+    u8 * laidOut = NULL;
+    arrsetcap(laidOut, arrlenu(*program) + functionCount * alignment);
+
+    // hot functions first so they share as few cache lines and pages as
+    // possible, cold ones last and packed since they are rarely run
+    for (Layout layout = LAYOUT_HOT; layout <= LAYOUT_COLD; layout++)
     {
-        .name               = nullString,
-        .info               = ELF_SYMBOL_INFO(ELF_SYMBOL_BINDING_LOCAL, ELF_SYMBOL_TYPE_NONE),
-        .other              = ELF_SYMBOL_OTHER(ELF_SYMBOL_VISIBILITY_DEFAULT),
-        .sectionHeaderIndex = 1,
-        .value              = 0,
-        .size               = 0
-    });
+        for (usize i = 0; i < functionCount; i++)
+        {
+            if (functions[i].layout != layout) continue;
+
+            usize end = arrlenu(laidOut);
+            usize begin = layout == LAYOUT_COLD ? end : (end + alignment - 1) & ~(alignment - 1);
+
+            arrsetlen(laidOut, begin + functions[i].size);
+            nopPadding(laidOut + end, begin - end);
+            memcpy(laidOut + begin, *program + functions[i].address, functions[i].size);
+
+            functions[i].address = begin;
+        }
+    }
+
+    arrfree(*program);
+    *program = laidOut;
+}
+
+void reportPeephole(const Symbol * functionTable, const FunctionCode * functions, usize functionCount)
+{
+    usize total = 0;
 
     for (usize i = 0; i < functionCount; i++)
     {
-        addSymbol(&symbolTable, (Elf64Symbol)
-        {
-            .name               = functionNames[i],
-            .info               = ELF_SYMBOL_INFO(ELF_SYMBOL_BINDING_GLOBAL, ELF_SYMBOL_TYPE_FUNCTION),
-            .other              = ELF_SYMBOL_OTHER(ELF_SYMBOL_VISIBILITY_DEFAULT),
-            .sectionHeaderIndex = 3,
-            .value              = functionAddresses[i],
-            // TODO:
-            .size               = 0
-        });
+        printf("peephole: %s: %zu B saved\n", functionTable[i].name, functions[i].peepholeSaved);
+        total += functions[i].peepholeSaved;
     }
 
-    usize identifierOffset   = 0;
-    usize headerOffset       = identifierOffset + sizeof(ElfIdentifier);
-    usize nullHeaderOffset   = headerOffset + sizeof(Elf64Header);
-    usize strtabHeaderOffset = nullHeaderOffset + sizeof(Elf64SectionHeader);
-    usize symtabHeaderOffset = strtabHeaderOffset + sizeof(Elf64SectionHeader);
-    usize textHeaderOffset   = symtabHeaderOffset + sizeof(Elf64SectionHeader);
-    usize strtabOffset       = textHeaderOffset + sizeof(Elf64SectionHeader);
-    usize symtabOffset       = strtabOffset + arrlenu(stringTable) * sizeof(char);
-    usize textOffset         = symtabOffset + arrlenu(symbolTable) * sizeof(Elf64Symbol);
-    usize fileSize           = textOffset + arrlen(program);
+    printf("peephole: %zu B saved in total\n", total);
+}
 
+Image translate(const Instruction * instructions, usize instructionCount, Symbol * functionTable, usize functionCount, const SourceFile * source)
+{
     // FIXME: memory leak!
-    u8 * bytes = malloc(fileSize);
-    assert(bytes);
-
-    ElfIdentifier * ident   = (ElfIdentifier *)(bytes + identifierOffset);
-    ident->magic            = ELF_MAGIC;
-    ident->class            = ELF_CLASS_64;
-    ident->endianness       = ELF_ENDIANNESS_LITTLE;
-    ident->version          = ELF_VERSION_1;
-    ident->extension        = ELF_EXTENSION_NONE;
-    ident->extensionVersion = 0;
-
-    Elf64Header * header              = (Elf64Header *)(bytes + headerOffset);
-    header->type                      = ELF_TYPE_RELOCATABLE;
-    header->arch                      = ELF_ARCH_X86_64;
-    header->version                   = ELF_VERSION_1;
-    header->entry                     = 0;
-    header->programHeadersOffset      = 0;
-    header->sectionHeadersOffset      = nullHeaderOffset;
-    header->flags                     = 0;
-    header->headerSize                = sizeof(Elf64Header);
-    header->programHeaderSize         = 0;
-    header->programHeaderCount        = 0;
-    header->sectionHeaderSize         = sizeof(Elf64SectionHeader);
-    header->sectionHeaderCount        = 4;
-    header->sectionNameTableIndex     = 1;
-
-    Elf64SectionHeader * nullHeader   = (Elf64SectionHeader *)(bytes + nullHeaderOffset);
-    nullHeader->name                  = nullString;
-    nullHeader->type                  = ELF_SECTION_TYPE_NULL;
-    nullHeader->flags                 = 0;
-    nullHeader->address               = 0;
-    nullHeader->offset                = 0;
-    nullHeader->size                  = 0;
-    nullHeader->link                  = 0;
-    nullHeader->info                  = 0;
-    nullHeader->addressAlign          = 0;
-    nullHeader->entrySize             = 0;
-
-    Elf64SectionHeader * strtabHeader = (Elf64SectionHeader *)(bytes + strtabHeaderOffset);
-    strtabHeader->name                = strtabName;
-    strtabHeader->type                = ELF_SECTION_TYPE_STRING_TABLE;
-    strtabHeader->flags               = 0;
-    strtabHeader->address             = 0;
-    strtabHeader->offset              = strtabOffset;
-    strtabHeader->size                = arrlenu(stringTable);
-    strtabHeader->link                = 0;
-    strtabHeader->info                = 0;
-    strtabHeader->addressAlign        = 0;
-    strtabHeader->entrySize           = 0;
-
-    Elf64SectionHeader * symtabHeader = (Elf64SectionHeader *)(bytes + symtabHeaderOffset);
-    symtabHeader->name                = symtabName;
-    symtabHeader->type                = ELF_SECTION_TYPE_SYMBOL_TABLE;
-    symtabHeader->flags               = 0;
-    symtabHeader->address             = 0;
-    symtabHeader->offset              = symtabOffset;
-    symtabHeader->size                = arrlenu(symbolTable) * sizeof(Elf64Symbol);
-    symtabHeader->link                = 1;
-    symtabHeader->info                = 1;
-    symtabHeader->addressAlign        = alignof(Elf64Symbol);
-    symtabHeader->entrySize           = sizeof(Elf64Symbol);
-
-    Elf64SectionHeader * textHeader   = (Elf64SectionHeader *)(bytes + textHeaderOffset);
-    textHeader->name                  = textName;
-    textHeader->type                  = ELF_SECTION_TYPE_DATA;
-    textHeader->flags                 = ELF_SECTION_FLAG_ALLOC | ELF_SECTION_FLAG_EXEC;
-    textHeader->address               = 0;
-    textHeader->offset                = textOffset;
-    textHeader->size                  = arrlenu(program);
-    textHeader->link                  = 0;
-    textHeader->info                  = 0;
-    textHeader->addressAlign          = 0;
-    textHeader->entrySize             = 0;
-
-    memcpy(bytes + strtabOffset, stringTable, arrlenu(stringTable));
-
-    memcpy(bytes + symtabOffset, symbolTable, arrlenu(symbolTable) * sizeof(Elf64Symbol));
-
-    memcpy(bytes + textOffset, program, arrlen(program));
-
-    *byteCount = fileSize;
-    return bytes;
+    u8 * program = NULL;
+    FunctionCode functions[functionCount];
+
+    lower(instructions, instructionCount, &program, functions);
+
+    if (targetOptions.reportPeephole) reportPeephole(functionTable, functions, functionCount);
+
+    layoutFunctions(&program, functions, functionCount);
+
+    if (targetOptions.executable) return emitExecutable(program, arrlenu(program), functionTable, functions, functionCount);
+
+    return emitObject(program, arrlenu(program), functionTable, functions, functionCount, source);
+}
+
+i32 run(const Instruction * instructions, usize instructionCount, Symbol * functionTable, usize functionCount)
+{
+    u8 * program = NULL;
+    FunctionCode functions[functionCount];
+
+    lower(instructions, instructionCount, &program, functions);
+
+    if (targetOptions.reportPeephole) reportPeephole(functionTable, functions, functionCount);
+
+    layoutFunctions(&program, functions, functionCount);
+
+    i32 result = runProgram(program, arrlenu(program), functionTable, functions, functionCount);
+
+    arrfree(program);
+    return result;
 }
\ No newline at end of file
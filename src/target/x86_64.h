@@ -0,0 +1,249 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "number.h"
+#include "compiler.h"
+
+typedef struct {
+    // keep slots in general-purpose registers instead of on the stack
+    bool allocateRegisters;
+    // let slots with disjoint lifetimes share stack space
+    bool packStackSlots;
+    // cover whole expressions with lea and immediate or memory operands
+    // instead of lowering one instruction at a time
+    bool selectInstructions;
+    // clean up the machine code of every function before it is encoded
+    bool peephole;
+    // print how many bytes the peephole optimizer saved per function
+    bool reportPeephole;
+    // a power of two every function entry point not marked cold is aligned to
+    usize functionAlignment;
+    // record which source every piece of machine code was generated from
+    bool debugInfo;
+    // link the functions into a static executable instead of emitting an object
+    bool executable;
+    // give every function a section of its own in objects, so that linkers can
+    // drop the unused ones
+    bool functionSections;
+    // the code is run in this process, where main has to return its result to
+    // the caller instead of exiting
+    bool jit;
+    // tell perf what the code run in this process is, in /tmp/perf-<pid>.map
+    // and in the jitdump format in /tmp/jit-<pid>.dump
+    bool perfMap;
+    bool jitdump;
+} TargetOptions;
+
+extern TargetOptions targetOptions;
+
+typedef u8 Register;
+#define REG_RAX  0
+#define REG_RCX  1
+#define REG_RDX  2
+#define REG_RBX  3
+#define REG_RSP  4
+#define REG_RBP  5
+#define REG_RSI  6
+#define REG_RDI  7
+#define REG_R8   8
+#define REG_R9   9
+#define REG_R10  10
+#define REG_R11  11
+#define REG_R12  12
+#define REG_R13  13
+#define REG_R14  14
+#define REG_R15  15
+#define REG_NONE 0xff
+
+// registers a call may overwrite, as a mask of 1 << Register
+#define CALLER_SAVED_REGISTERS (1 << REG_RAX | 1 << REG_RCX | 1 << REG_RDX | 1 << REG_RSI | 1 << REG_RDI \
+                              | 1 << REG_R8  | 1 << REG_R9  | 1 << REG_R10 | 1 << REG_R11)
+
+typedef u8 OperandKind;
+#define OPERAND_NONE      0
+#define OPERAND_REGISTER  1
+#define OPERAND_IMMEDIATE 2
+#define OPERAND_MEMORY    3
+
+typedef struct {
+    OperandKind kind;
+
+    union {
+        // OPERAND_REGISTER
+        struct {
+            Register reg;
+        };
+        // OPERAND_IMMEDIATE
+        struct {
+            i32 immediate;
+        };
+        // OPERAND_MEMORY, [base + index + displacement]
+        struct {
+            Register base;
+            Register index;
+            i32      displacement;
+        };
+    };
+} Operand;
+
+typedef u8 MachineOp;
+#define MO_NONE    0
+// 32-bit
+#define MO_MOV     1
+#define MO_ADD     2
+#define MO_XOR     3
+#define MO_LEA     4
+// 64-bit
+#define MO_PUSH    5
+#define MO_POP     6
+#define MO_SUB_RSP 7
+#define MO_ADD_RSP 8
+#define MO_RET     9
+#define MO_SYSCALL 10
+// call rel32, the immediate indexes the calls of the function
+#define MO_CALL    11
+// jmp rel32, the displacement is filled in once the target has an address
+#define MO_JMP     12
+
+// a machine instruction between instruction selection and encoding
+typedef struct {
+    MachineOp op;
+    Operand   dst;
+    Operand   src;
+
+    // copied from the instruction the machine instruction was lowered from
+    usize     sourceOffset;
+} MachineInstruction;
+
+// the machine code from `address` on, relative to the entry point of its
+// function, was generated from the source at `sourceOffset`
+typedef struct {
+    u64   address;
+    usize sourceOffset;
+} LineMapping;
+
+// a call to `callee` whose rel32 operand is at `offset`, relative to the entry
+// point of the calling function until calls are resolved
+typedef struct {
+    u64  offset;
+    u8 * callee;
+} CallSite;
+
+// the source file debug information refers to
+typedef struct {
+    const char * path;
+    const u8 *   text;
+    usize        length;
+} SourceFile;
+
+typedef struct {
+    u64           address;
+    u64           size;
+    Layout        layout;
+    // bytes removed by the peephole optimizer
+    usize         peepholeSaved;
+    // call frame instructions for .eh_frame, relative to the entry point
+    u8 *          cfi;
+    // in order of address, a mapping only starts where the source changes
+    LineMapping * lines;
+    CallSite *    calls;
+    // ends the process itself instead of returning, and expects rsp 16-byte
+    // aligned on entry
+    bool          exits;
+    Linkage       linkage;
+} FunctionCode;
+
+bool sameOperand(Operand a, Operand b);
+
+// rewrites the machine code of one function in place
+void peephole(MachineInstruction ** code);
+
+// lowers `instructions` to machine code appended to `*program`, storing the
+// address of every function it begins in `functions`
+void lower(const Instruction * instructions, usize instructionCount, u8 ** program, FunctionCode * functions);
+
+// reorders the functions in `*program` by layout and aligns their entry
+// points, updating their addresses
+void layoutFunctions(u8 ** program, FunctionCode * functions, usize functionCount);
+
+// points every call in `program` to a function in `functionTable` straight at
+// it and returns the others, with offsets into `program`
+CallSite * resolveCalls(u8 * program, const Symbol * functionTable, const FunctionCode * functions, usize functionCount);
+
+// a file as the pieces it is made of, in order of offset. whatever lies between
+// them is zero
+typedef struct {
+    u64          offset;
+    const void * data;
+    usize        size;
+} ImagePiece;
+
+typedef struct {
+    ImagePiece * pieces;
+    usize        size;
+} Image;
+
+// writes every piece of `image` straight from where it is to the file at `path`
+bool writeImage(const Image * image, const char * path);
+
+// unless `source` is NULL, the object also gets debug information mapping its
+// code back to the lines of `source`
+Image emitObject(u8 * program, usize programLen, const Symbol * functionTable, const FunctionCode * functions, usize functionCount, const SourceFile * source);
+
+// links the functions into an executable starting at `main`, every call has
+// to be to one of them
+Image emitExecutable(u8 * program, usize programLen, const Symbol * functionTable, const FunctionCode * functions, usize functionCount);
+
+// memory code is run from in this process. all of it is reserved up front so
+// that calls between any two functions in it reach with rel32, and it is never
+// writable and executable at once
+typedef struct {
+    u8 *   base;
+    usize  reserved;
+    usize  used;
+    usize  pageSize;
+
+    // NULL unless enabled in `targetOptions`
+    FILE * perfMap;
+    FILE * jitdump;
+    // perf only finds the jitdump through an executable mapping of it
+    void * jitdumpMarker;
+    u64    codeCount;
+} CodeMemory;
+
+CodeMemory reserveCode(usize size);
+void releaseCode(CodeMemory * memory);
+// the returned code is only readable once it is written with `writeCode`
+u8 * allocateCode(CodeMemory * memory, usize size, usize alignment);
+void writeCode(CodeMemory * memory, u8 * at, const void * data, usize size);
+// tells profilers the written code from `code` on is the function `name`
+void nameCode(CodeMemory * memory, const u8 * code, usize size, const char * name);
+
+// a stub passes its index in edi to the trampoline, which calls
+// `resolve(index, context)` and jumps to the address it returns
+#define STUB_SIZE       16
+#define TRAMPOLINE_SIZE 32
+#define JUMP_SIZE       5
+
+typedef const u8 * (* StubResolver)(u32 index, void * context);
+
+// `at` is where the built code is going to be written to
+void buildStub(u8 * out, const u8 * at, u32 index, const u8 * trampoline);
+void buildTrampoline(u8 * out, StubResolver resolve, void * context);
+void buildJump(u8 * out, const u8 * at, const u8 * target);
+
+// main as it is called from c once it is in executable memory
+typedef i32 (* MainFunction)(void);
+
+// maps the functions to executable memory and calls `main`, returning its
+// result. every call has to be to one of them
+i32 runProgram(u8 * program, usize programLen, const Symbol * functionTable, const FunctionCode * functions, usize functionCount);
+
+void reportPeephole(const Symbol * functionTable, const FunctionCode * functions, usize functionCount);
+
+Image translate(const Instruction * instructions, usize instructionCount, Symbol * functionTable, usize functionCount, const SourceFile * source);
+
+// like `translate`, but runs the code instead of emitting it
+i32 run(const Instruction * instructions, usize instructionCount, Symbol * functionTable, usize functionCount);
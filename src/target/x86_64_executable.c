@@ -0,0 +1,191 @@
+#include <stdalign.h>
+#include <stdio.h>
+
+#include "number.h"
+#include "stb_ds.h"
+#include "elf.h"
+
+#include "target/x86_64.h"
+
+// a static executable for programs calling nothing but their own functions.
+// everything is loaded as a single read-only, executable segment starting with
+// the headers, the sections only follow it for the benefit of tools
+
+// where the image is loaded, the usual default of non-position-independent code
+#define EXECUTABLE_BASE_ADDRESS 0x400000
+#define PAGE_SIZE               0x1000
+
+// the program entry point. a main that returns is called and its result is
+// passed to exit, one that exits by itself is jumped to with the stack as the
+// kernel leaves it, 16-byte aligned
+static u8 * buildStart(bool mainExits)
+{
+    MachineInstruction start[4];
+    usize count = 0;
+
+    if (mainExits) start[count++] = (MachineInstruction){ MO_JMP, .src = imm(0) };
+    else
+    {
+        start[count++] = (MachineInstruction){ MO_CALL, .src = imm(0) };
+        start[count++] = (MachineInstruction){ MO_MOV, reg(REG_RDI), reg(REG_RAX) };
+        start[count++] = (MachineInstruction){ MO_MOV, reg(REG_RAX), imm(0x3c) };
+        start[count++] = (MachineInstruction){ MO_SYSCALL };
+    }
+
+    u8 * bytes = NULL;
+    for (usize i = 0; i < count; i++)
+    {
+        usize offset = arrlenu(bytes);
+        arrsetlen(bytes, offset + MAX_INSTRUCTION_LENGTH);
+        arrsetlen(bytes, offset + encodeInto(bytes + offset, &start[i]));
+    }
+
+    return bytes;
+}
+
+// resolves every call in `program` and returns the index of main, for code
+// that is run without a linker
+static usize linkMain(u8 * program, const Symbol * functionTable, const FunctionCode * functions, usize functionCount)
+{
+    CallSite * unresolved = resolveCalls(program, functionTable, functions, functionCount);
+    if (arrlenu(unresolved) != 0)
+    {
+        printf("undefined function '%s'\n", unresolved[0].callee);
+        exit(1);
+    }
+    arrfree(unresolved);
+
+    usize mainIndex = functionCount;
+    for (usize i = 0; i < functionCount; i++)
+    {
+        if (strcmp((const char *) functionTable[i].name, "main") == 0) mainIndex = i;
+    }
+
+    if (mainIndex == functionCount)
+    {
+        printf("no function 'main' to start from\n");
+        exit(1);
+    }
+
+    return mainIndex;
+}
+
+Image emitExecutable(u8 * program, usize programLen, const Symbol * functionTable, const FunctionCode * functions, usize functionCount)
+{
+    usize mainIndex = linkMain(program, functionTable, functions, functionCount);
+
+    // FIXME: memory leak!
+    u8 * start = buildStart(functions[mainIndex].exits);
+
+    StringTable stringTable = { 0 };
+    usize nullString = addString(&stringTable, "");
+
+    // the loaded sections come first, right after the headers
+    Section * sections = NULL;
+    addSection(&sections, (Section){ .name = nullString, .type = ELF_SECTION_TYPE_NULL });
+
+    usize textIndex = addSection(&sections, (Section)
+    {
+        .name         = addString(&stringTable, ".text"),
+        .type         = ELF_SECTION_TYPE_DATA,
+        .flags        = ELF_SECTION_FLAG_ALLOC | ELF_SECTION_FLAG_EXEC,
+        .addressAlign = targetOptions.functionAlignment,
+        .data         = program,
+        .size         = programLen
+    });
+    usize startIndex = addSection(&sections, (Section)
+    {
+        .name         = addString(&stringTable, ".text.start"),
+        .type         = ELF_SECTION_TYPE_DATA,
+        .flags        = ELF_SECTION_FLAG_ALLOC | ELF_SECTION_FLAG_EXEC,
+        .addressAlign = 16,
+        .data         = start,
+        .size         = arrlenu(start)
+    });
+    usize strtabIndex = addSection(&sections, (Section)
+    {
+        .name         = addString(&stringTable, ".strtab"),
+        .type         = ELF_SECTION_TYPE_STRING_TABLE
+    });
+    usize symtabIndex = addSection(&sections, (Section)
+    {
+        .name         = addString(&stringTable, ".symtab"),
+        .type         = ELF_SECTION_TYPE_SYMBOL_TABLE,
+        .link         = strtabIndex,
+        .info         = 1,
+        .addressAlign = alignof(Elf64Symbol),
+        .entrySize    = sizeof(Elf64Symbol)
+    });
+
+    // the offsets of the loaded sections don't depend on the symbol and string
+    // tables after them, so addresses are known before those are built
+    usize segmentCount = 2;
+    usize offsets[arrlenu(sections)];
+    layoutSections(sections, arrlenu(sections), segmentCount, offsets);
+
+    sections[textIndex].address  = EXECUTABLE_BASE_ADDRESS + offsets[textIndex];
+    sections[startIndex].address = EXECUTABLE_BASE_ADDRESS + offsets[startIndex];
+
+    u64 mainAddress = sections[textIndex].address + functions[mainIndex].address;
+    u64 entry = sections[startIndex].address;
+    // the call or jmp to main is the first instruction
+    put32At(start, 1, (u32)(mainAddress - (entry + 5)));
+
+    Elf64Symbol * symbolTable = NULL;
+    addSymbol(&symbolTable, (Elf64Symbol){ 0 });
+
+    for (usize i = 0; i < functionCount; i++)
+    {
+        addSymbol(&symbolTable, (Elf64Symbol)
+        {
+            .name               = addString(&stringTable, (char *) functionTable[i].name),
+            .info               = ELF_SYMBOL_INFO(ELF_SYMBOL_BINDING_GLOBAL, ELF_SYMBOL_TYPE_FUNCTION),
+            .other              = ELF_SYMBOL_OTHER(ELF_SYMBOL_VISIBILITY_DEFAULT),
+            .sectionHeaderIndex = textIndex,
+            .value              = sections[textIndex].address + functions[i].address,
+            .size               = functions[i].size
+        });
+    }
+
+    addSymbol(&symbolTable, (Elf64Symbol)
+    {
+        .name               = addString(&stringTable, "_start"),
+        .info               = ELF_SYMBOL_INFO(ELF_SYMBOL_BINDING_GLOBAL, ELF_SYMBOL_TYPE_FUNCTION),
+        .other              = ELF_SYMBOL_OTHER(ELF_SYMBOL_VISIBILITY_DEFAULT),
+        .sectionHeaderIndex = startIndex,
+        .value              = entry,
+        .size               = arrlenu(start)
+    });
+
+    char * strings = finishStringTable(&stringTable, sections, arrlenu(sections), symbolTable, arrlenu(symbolTable));
+
+    setSectionData(&sections[symtabIndex], symbolTable, arrlenu(symbolTable) * sizeof(Elf64Symbol));
+    setSectionData(&sections[strtabIndex], strings, arrlenu(strings));
+
+    usize loadedSize = offsets[startIndex] + arrlenu(start);
+
+    Elf64ProgramHeader segments[] = {
+        {
+            .type            = ELF_SEGMENT_TYPE_LOAD,
+            .flags           = ELF_SEGMENT_FLAG_READ | ELF_SEGMENT_FLAG_EXEC,
+            .offset          = 0,
+            .virtualAddress  = EXECUTABLE_BASE_ADDRESS,
+            .physicalAddress = EXECUTABLE_BASE_ADDRESS,
+            .fileSize        = loadedSize,
+            .memorySize      = loadedSize,
+            .alignment       = PAGE_SIZE
+        },
+        // keeps the stack from being executable
+        {
+            .type            = ELF_SEGMENT_TYPE_GNU_STACK,
+            .flags           = ELF_SEGMENT_FLAG_READ | ELF_SEGMENT_FLAG_WRITE,
+            .alignment       = 16
+        },
+    };
+    assert(sizeof(segments) / sizeof(segments[0]) == segmentCount);
+
+    Image image = buildImage(ELF_TYPE_EXECUTABLE, entry, segments, segmentCount, sections, arrlenu(sections), strtabIndex);
+
+    arrfree(sections);
+    return image;
+}
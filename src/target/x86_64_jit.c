@@ -0,0 +1,207 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "number.h"
+#include "stb_ds.h"
+#include "elf.h"
+#include "jitdump.h"
+
+#include "target/x86_64.h"
+
+// machine code run straight from memory, with no object or linker in between.
+// main is lowered with the c protocol there, so it returns to its caller
+
+static void openProfilerOutput(CodeMemory * memory)
+{
+    char path[64];
+
+    if (targetOptions.perfMap)
+    {
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+        memory->perfMap = fopen(path, "w");
+        assert(memory->perfMap);
+    }
+
+    if (targetOptions.jitdump)
+    {
+        snprintf(path, sizeof(path), "/tmp/jit-%d.dump", getpid());
+        int file = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+        assert(file >= 0);
+
+        // recorded by perf record, which is how perf inject finds the file
+        memory->jitdumpMarker = mmap(NULL, memory->pageSize, PROT_READ | PROT_EXEC, MAP_PRIVATE, file, 0);
+        assert(memory->jitdumpMarker != MAP_FAILED);
+
+        memory->jitdump = fdopen(file, "w");
+        assert(memory->jitdump);
+
+        JitdumpHeader header = {
+            .magic      = JITDUMP_MAGIC,
+            .version    = JITDUMP_VERSION,
+            .headerSize = sizeof(header),
+            .arch       = ELF_ARCH_X86_64,
+            .pid        = getpid(),
+            .timestamp  = now()
+        };
+        assert(fwrite(&header, sizeof(header), 1, memory->jitdump) == 1);
+    }
+}
+
+static void closeProfilerOutput(CodeMemory * memory)
+{
+    if (memory->perfMap != NULL) assert(fclose(memory->perfMap) == 0);
+
+    if (memory->jitdump != NULL)
+    {
+        JitdumpRecordHeader close = { JITDUMP_RECORD_CLOSE, sizeof(close), now() };
+        assert(fwrite(&close, sizeof(close), 1, memory->jitdump) == 1);
+        assert(fclose(memory->jitdump) == 0);
+
+        assert(munmap(memory->jitdumpMarker, memory->pageSize) == 0);
+    }
+}
+
+void nameCode(CodeMemory * memory, const u8 * code, usize size, const char * name)
+{
+    if (memory->perfMap != NULL) fprintf(memory->perfMap, "%lx %zx %s\n", (unsigned long)(uintptr_t) code, size, name);
+
+    if (memory->jitdump != NULL)
+    {
+        usize nameSize = strlen(name) + 1;
+
+        // code only ever runs on the thread that compiled it, the main one
+        JitdumpCodeLoad load = {
+            .header         = { JITDUMP_RECORD_CODE_LOAD, sizeof(load) + nameSize + size, now() },
+            .pid            = getpid(),
+            .tid            = getpid(),
+            .virtualAddress = (uintptr_t) code,
+            .codeAddress    = (uintptr_t) code,
+            .codeSize       = size,
+            .codeIndex      = memory->codeCount++
+        };
+
+        assert(fwrite(&load, sizeof(load), 1, memory->jitdump) == 1);
+        assert(fwrite(name, nameSize, 1, memory->jitdump) == 1);
+        assert(size == 0 || fwrite(code, size, 1, memory->jitdump) == 1);
+    }
+}
+
+CodeMemory reserveCode(usize size)
+{
+    long pageSize = sysconf(_SC_PAGESIZE);
+    assert(pageSize > 0);
+
+    CodeMemory memory = { .pageSize = pageSize };
+    memory.reserved = (size + pageSize - 1) & ~(memory.pageSize - 1);
+
+    // pages only get backed once they are written to
+    memory.base = mmap(NULL, memory.reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(memory.base != MAP_FAILED);
+
+    openProfilerOutput(&memory);
+
+    return memory;
+}
+
+void releaseCode(CodeMemory * memory)
+{
+    closeProfilerOutput(memory);
+
+    assert(munmap(memory->base, memory->reserved) == 0);
+    *memory = (CodeMemory){ 0 };
+}
+
+u8 * allocateCode(CodeMemory * memory, usize size, usize alignment)
+{
+    assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+    usize begin = (memory->used + alignment - 1) & ~(alignment - 1);
+    if (begin + size > memory->reserved)
+    {
+        printf("out of memory for code (%zu B reserved)\n", memory->reserved);
+        exit(1);
+    }
+
+    memory->used = begin + size;
+    return memory->base + begin;
+}
+
+void writeCode(CodeMemory * memory, u8 * at, const void * data, usize size)
+{
+    assert(at >= memory->base && at + size <= memory->base + memory->used);
+
+    uintptr_t first = (uintptr_t) at & ~(memory->pageSize - 1);
+    uintptr_t last  = ((uintptr_t) at + size + memory->pageSize - 1) & ~(memory->pageSize - 1);
+
+    // nothing runs from these pages until this returns, the code is only ever
+    // called into from here
+    assert(mprotect((void *) first, last - first, PROT_READ | PROT_WRITE) == 0);
+    memcpy(at, data, size);
+    assert(mprotect((void *) first, last - first, PROT_READ | PROT_EXEC) == 0);
+}
+
+void buildJump(u8 * out, const u8 * at, const u8 * target)
+{
+    MachineInstruction jump = { MO_JMP, .src = imm(0) };
+    assert(encodeInto(out, &jump) == JUMP_SIZE);
+    put32At(out, 1, (u32)(target - (at + JUMP_SIZE)));
+}
+
+void buildStub(u8 * out, const u8 * at, u32 index, const u8 * trampoline)
+{
+    MachineInstruction load = { MO_MOV, reg(REG_RDI), imm(index) };
+    usize length = encodeInto(out, &load);
+
+    buildJump(out + length, at + length, trampoline);
+    length += JUMP_SIZE;
+
+    assert(length <= STUB_SIZE);
+    nopPadding(out + length, STUB_SIZE - length);
+}
+
+void buildTrampoline(u8 * out, StubResolver resolve, void * context)
+{
+    // callers of a stub expect nothing but the callee-saved registers to be
+    // preserved, and the resolver preserves those itself
+    static const u8 trampoline[TRAMPOLINE_SIZE] = {
+        // sub rsp, 8, realigning the stack the call to the stub misaligned
+        0x48, 0x83, 0xec, 0x08,
+        // mov rsi, context
+        0x48, 0xbe, 0, 0, 0, 0, 0, 0, 0, 0,
+        // mov rax, resolve
+        0x48, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0,
+        // call rax
+        0xff, 0xd0,
+        // add rsp, 8
+        0x48, 0x83, 0xc4, 0x08,
+        // jmp rax, as if the stub had been the function all along
+        0xff, 0xe0,
+    };
+
+    memcpy(out, trampoline, TRAMPOLINE_SIZE);
+
+    u64 contextAddress = (uintptr_t) context;
+    u64 resolveAddress = (uintptr_t) resolve;
+    memcpy(out + 6, &contextAddress, sizeof(contextAddress));
+    memcpy(out + 16, &resolveAddress, sizeof(resolveAddress));
+}
+
+i32 runProgram(u8 * program, usize programLen, const Symbol * functionTable, const FunctionCode * functions, usize functionCount)
+{
+    usize mainIndex = linkMain(program, functionTable, functions, functionCount);
+
+    CodeMemory memory = reserveCode(programLen);
+    u8 * code = allocateCode(&memory, programLen, 1);
+    writeCode(&memory, code, program, programLen);
+
+    for (usize i = 0; i < functionCount; i++) nameCode(&memory, code + functions[i].address, functions[i].size, (const char *) functionTable[i].name);
+
+    MainFunction entry = (MainFunction)(code + functions[mainIndex].address);
+    i32 result = entry();
+
+    releaseCode(&memory);
+
+    return result;
+}
@@ -0,0 +1,987 @@
+#include <fcntl.h>
+#include <stdalign.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "number.h"
+#include "stb_ds.h"
+#include "elf.h"
+#include "dwarf.h"
+
+#include "target/x86_64.h"
+
+// a string table in which equal strings share one entry and a string that is
+// the tail of another one points into it. offsets are only known once every
+// string is in, until then strings are referred to by the index they were
+// first added at
+typedef struct {
+    struct { char * key; u32 value; } * indices;
+    // by index, owned by the arena of `indices`
+    const char ** strings;
+} StringTable;
+
+u32 addString(StringTable * table, const char * string)
+{
+    // the empty string comes first, at offset 0 like ELF requires
+    if (table->indices == NULL)
+    {
+        sh_new_arena(table->indices);
+        shput(table->indices, "", 0);
+        arrpush(table->strings, shgetp(table->indices, "")->key);
+    }
+
+    i64 existing = shgeti(table->indices, (char *) string);
+    if (existing >= 0) return table->indices[existing].value;
+
+    u32 index = arrlenu(table->strings);
+    shput(table->indices, (char *) string, index);
+    arrpush(table->strings, shgetp(table->indices, (char *) string)->key);
+    return index;
+}
+
+usize addSymbol(Elf64Symbol ** symbolTable, Elf64Symbol symbol)
+{
+    usize offset = arrlenu(*symbolTable) * sizeof(Elf64Symbol);
+    arrpush(*symbolTable, symbol);
+    return offset;
+}
+
+// the contents and header fields of one section, the offset is computed when
+// the object is written
+typedef struct {
+    u32             name;
+    ElfSectionType  type;
+    ElfSectionFlags flags;
+    // where the section is loaded, only in executables
+    u64             address;
+    u32             link;
+    u32             info;
+    u64             addressAlign;
+    u64             entrySize;
+    const void *    data;
+    usize           size;
+} Section;
+
+// the identifier, the header, the program headers and the section headers
+// come first, in that order
+static usize headersSize(usize sectionCount, usize segmentCount)
+{
+    return sizeof(ElfIdentifier) + sizeof(Elf64Header) + segmentCount * sizeof(Elf64ProgramHeader) + sectionCount * sizeof(Elf64SectionHeader);
+}
+
+// stores the file offset of every section in `offsets` and returns the size of
+// the file. a section's offset only depends on the ones before it
+static usize layoutSections(const Section * sections, usize sectionCount, usize segmentCount, usize * offsets)
+{
+    usize fileSize = headersSize(sectionCount, segmentCount);
+
+    for (usize i = 0; i < sectionCount; i++)
+    {
+        usize alignment = sections[i].addressAlign == 0 ? 1 : sections[i].addressAlign;
+        offsets[i] = sections[i].type == ELF_SECTION_TYPE_NULL ? 0 : (fileSize + alignment - 1) & ~(alignment - 1);
+        if (sections[i].type != ELF_SECTION_TYPE_NULL) fileSize = offsets[i] + sections[i].size;
+    }
+
+    return fileSize;
+}
+
+// lays out the headers and the contents of `sections`, the first of which must
+// be the null section. relocatable objects have no `segments` and no entry.
+// only the headers are built here, the contents are written from where they
+// are, which has to outlive the image
+static Image buildImage(ElfType type, u64 entry, const Elf64ProgramHeader * segments, usize segmentCount, const Section * sections, usize sectionCount, u16 sectionNameTableIndex)
+{
+    usize identifierOffset     = 0;
+    usize headerOffset         = identifierOffset + sizeof(ElfIdentifier);
+    usize programHeadersOffset = headerOffset + sizeof(Elf64Header);
+    usize sectionHeadersOffset = programHeadersOffset + segmentCount * sizeof(Elf64ProgramHeader);
+
+    usize offsets[sectionCount];
+    usize fileSize = layoutSections(sections, sectionCount, segmentCount, offsets);
+
+    // FIXME: memory leak!
+    u8 * bytes = calloc(headersSize(sectionCount, segmentCount), 1);
+    assert(bytes);
+
+    Image image = { .size = fileSize };
+    arrpush(image.pieces, ((ImagePiece){ 0, bytes, headersSize(sectionCount, segmentCount) }));
+
+    ElfIdentifier * ident   = (ElfIdentifier *)(bytes + identifierOffset);
+    ident->magic            = ELF_MAGIC;
+    ident->class            = ELF_CLASS_64;
+    ident->endianness       = ELF_ENDIANNESS_LITTLE;
+    ident->version          = ELF_VERSION_1;
+    ident->extension        = ELF_EXTENSION_NONE;
+    ident->extensionVersion = 0;
+
+    Elf64Header * header          = (Elf64Header *)(bytes + headerOffset);
+    header->type                  = type;
+    header->arch                  = ELF_ARCH_X86_64;
+    header->version               = ELF_VERSION_1;
+    header->entry                 = entry;
+    header->programHeadersOffset  = segmentCount != 0 ? programHeadersOffset : 0;
+    header->sectionHeadersOffset  = sectionHeadersOffset;
+    header->flags                 = 0;
+    header->headerSize            = sizeof(Elf64Header);
+    header->programHeaderSize     = segmentCount != 0 ? sizeof(Elf64ProgramHeader) : 0;
+    header->programHeaderCount    = segmentCount;
+    header->sectionHeaderSize     = sizeof(Elf64SectionHeader);
+    header->sectionHeaderCount    = sectionCount;
+    header->sectionNameTableIndex = sectionNameTableIndex;
+
+    if (segmentCount != 0) memcpy(bytes + programHeadersOffset, segments, segmentCount * sizeof(Elf64ProgramHeader));
+
+    for (usize i = 0; i < sectionCount; i++)
+    {
+        Elf64SectionHeader * sectionHeader = (Elf64SectionHeader *)(bytes + sectionHeadersOffset) + i;
+        sectionHeader->name                = sections[i].name;
+        sectionHeader->type                = sections[i].type;
+        sectionHeader->flags               = sections[i].flags;
+        sectionHeader->address             = sections[i].address;
+        sectionHeader->offset              = offsets[i];
+        sectionHeader->size                = sections[i].size;
+        sectionHeader->link                = sections[i].link;
+        sectionHeader->info                = sections[i].info;
+        sectionHeader->addressAlign        = sections[i].addressAlign;
+        sectionHeader->entrySize           = sections[i].entrySize;
+
+        if (sections[i].size != 0) arrpush(image.pieces, ((ImagePiece){ offsets[i], sections[i].data, sections[i].size }));
+    }
+
+    return image;
+}
+
+// how many pieces go into a single pwritev
+#define WRITE_BATCH 64
+
+bool writeImage(const Image * image, const char * path)
+{
+    int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (file < 0) return false;
+
+    // the padding between pieces is left as a hole, which reads as zeros
+    bool ok = ftruncate(file, image->size) == 0;
+
+    for (usize i = 0; ok && i < arrlenu(image->pieces);)
+    {
+        // pieces that follow each other directly go out together
+        struct iovec vectors[WRITE_BATCH];
+        usize count = 0;
+        u64 offset = image->pieces[i].offset, remaining = 0;
+
+        while (i < arrlenu(image->pieces) && count < WRITE_BATCH && image->pieces[i].offset == offset + remaining)
+        {
+            vectors[count++] = (struct iovec){ (void *) image->pieces[i].data, image->pieces[i].size };
+            remaining += image->pieces[i].size;
+            i++;
+        }
+
+        struct iovec * next = vectors;
+        while (ok && remaining != 0)
+        {
+            ssize_t written = pwritev(file, next, count - (next - vectors), offset);
+            if (written <= 0) { ok = false; break; }
+
+            offset    += written;
+            remaining -= written;
+
+            // continue after whatever was written
+            while (next->iov_len <= (usize) written && remaining != 0) { written -= next->iov_len; next++; }
+            next->iov_base = (u8 *) next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+
+    return close(file) == 0 && ok;
+}
+
+typedef struct {
+    const char * string;
+    usize        length;
+    u32          index;
+} StringEntry;
+
+// orders strings by their reversed contents, descending, so that every string
+// comes right after the ones it is the tail of
+static int compareReversed(const void * a, const void * b)
+{
+    const StringEntry * x = a;
+    const StringEntry * y = b;
+
+    for (usize i = x->length, j = y->length; i > 0 || j > 0;)
+    {
+        if (i == 0) return 1;
+        if (j == 0) return -1;
+
+        u8 p = x->string[--i], q = y->string[--j];
+        if (p != q) return p > q ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// builds the contents of `table`, replacing the string indices `sections` and
+// `symbols` are named by with offsets into it
+static char * finishStringTable(StringTable * table, Section * sections, usize sectionCount, Elf64Symbol * symbols, usize symbolCount)
+{
+    usize count = arrlenu(table->strings);
+
+    // FIXME: memory leak!
+    StringEntry * entries = NULL;
+    for (usize i = 1; i < count; i++) arrpush(entries, ((StringEntry){ table->strings[i], strlen(table->strings[i]), i }));
+
+    if (arrlenu(entries) != 0) qsort(entries, arrlenu(entries), sizeof(entries[0]), compareReversed);
+
+    u32 offsets[count];
+    offsets[0] = 0;
+
+    // FIXME: memory leak!
+    char * bytes = NULL;
+    arrpush(bytes, '\0');
+
+    // the last string actually stored, any tail of a string before it is also
+    // one of it
+    const StringEntry * stored = NULL;
+
+    for (usize i = 0; i < arrlenu(entries); i++)
+    {
+        const StringEntry * entry = &entries[i];
+
+        if (stored != NULL && stored->length >= entry->length && memcmp(stored->string + stored->length - entry->length, entry->string, entry->length) == 0)
+        {
+            offsets[entry->index] = offsets[stored->index] + stored->length - entry->length;
+            continue;
+        }
+
+        offsets[entry->index] = arrlenu(bytes);
+        arrsetlen(bytes, offsets[entry->index] + entry->length + 1);
+        memcpy(bytes + offsets[entry->index], entry->string, entry->length + 1);
+        stored = entry;
+    }
+
+    for (usize i = 0; i < sectionCount; i++) sections[i].name = offsets[sections[i].name];
+    for (usize i = 0; i < symbolCount; i++) symbols[i].name = offsets[symbols[i].name];
+
+    arrfree(entries);
+    arrfree(table->strings);
+    shfree(table->indices);
+
+    return bytes;
+}
+
+static usize addSection(Section ** sections, Section section)
+{
+    arrpush(*sections, section);
+    return arrlenu(*sections) - 1;
+}
+
+static void setSectionData(Section * section, const void * data, usize size)
+{
+    section->data = data;
+    section->size = size;
+}
+
+// a local symbol standing for the start of the section `sectionIndex`
+static u32 addSectionSymbol(Elf64Symbol ** symbolTable, usize sectionIndex)
+{
+    return addSymbol(symbolTable, (Elf64Symbol)
+    {
+        .name               = 0,
+        .info               = ELF_SYMBOL_INFO(ELF_SYMBOL_BINDING_LOCAL, ELF_SYMBOL_TYPE_SECTION),
+        .other              = ELF_SYMBOL_OTHER(ELF_SYMBOL_VISIBILITY_DEFAULT),
+        .sectionHeaderIndex = sectionIndex,
+        .value              = 0,
+        .size               = 0
+    }) / sizeof(Elf64Symbol);
+}
+
+static void put32At(u8 * bytes, usize offset, u32 value)
+{
+    memcpy(bytes + offset, &value, sizeof(value));
+}
+
+static void push32(u8 ** bytes, u32 value)
+{
+    usize offset = arrlenu(*bytes);
+    arrsetlen(*bytes, offset + sizeof(value));
+    put32At(*bytes, offset, value);
+}
+
+static void push16(u8 ** bytes, u16 value)
+{
+    arrpush(*bytes, value);
+    arrpush(*bytes, value >> 8);
+}
+
+static void push64(u8 ** bytes, u64 value)
+{
+    push32(bytes, value);
+    push32(bytes, value >> 32);
+}
+
+static void pushString(u8 ** bytes, const char * string)
+{
+    usize stringLen = strlen(string) + 1;
+    usize offset = arrlenu(*bytes);
+    arrsetlen(*bytes, offset + stringLen);
+    memcpy(*bytes + offset, string, stringLen);
+}
+
+static void pushSleb(u8 ** bytes, i64 value)
+{
+    for (;;)
+    {
+        u8 byte = value & 0x7f;
+        value >>= 7;
+
+        if ((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40)))
+        {
+            arrpush(*bytes, byte);
+            return;
+        }
+
+        arrpush(*bytes, byte | 0x80);
+    }
+}
+
+// pads the entry starting at `start` to a multiple of eight bytes and fills in
+// its length, which doesn't count the length field itself
+static void endFrameEntry(u8 ** ehFrame, usize start)
+{
+    while ((arrlenu(*ehFrame) - start) % 8 != 0) arrpush(*ehFrame, DWARF_CFA_NOP);
+    put32At(*ehFrame, start, arrlenu(*ehFrame) - start - 4);
+}
+
+// how relocations refer to the code of a function, a symbol and an offset
+// from it
+typedef struct {
+    u32 symbol;
+    u64 offset;
+} CodeReference;
+
+// one common information entry shared by one frame description entry per
+// function. the start of every function is a pc-relative relocation against
+// its `code`
+static void buildEhFrame(u8 ** ehFrame, Elf64Relocation ** relocations, const FunctionCode * functions, const CodeReference * code, usize functionCount)
+{
+    usize cie = arrlenu(*ehFrame);
+    push32(ehFrame, 0);
+    push32(ehFrame, DWARF_CIE_ID_EH_FRAME);
+    arrpush(*ehFrame, DWARF_CIE_VERSION);
+    // augmentation data with the encoding of the addresses in the entries
+    arrpush(*ehFrame, 'z');
+    arrpush(*ehFrame, 'R');
+    arrpush(*ehFrame, '\0');
+    // code alignment factor
+    pushUleb(ehFrame, 1);
+    // data alignment factor
+    pushSleb(ehFrame, -8);
+    pushUleb(ehFrame, DWARF_X86_64_RETURN_ADDRESS);
+    pushUleb(ehFrame, 1);
+    arrpush(*ehFrame, DWARF_POINTER_PCREL | DWARF_POINTER_SDATA4);
+    // on entry the return address is the only thing on the stack
+    arrpush(*ehFrame, DWARF_CFA_DEF_CFA);
+    pushUleb(ehFrame, DWARF_X86_64_RSP);
+    pushUleb(ehFrame, 8);
+    arrpush(*ehFrame, DWARF_CFA_OFFSET | DWARF_X86_64_RETURN_ADDRESS);
+    pushUleb(ehFrame, 1);
+    endFrameEntry(ehFrame, cie);
+
+    for (usize i = 0; i < functionCount; i++)
+    {
+        usize fde = arrlenu(*ehFrame);
+        push32(ehFrame, 0);
+        // the distance back to the common information entry
+        push32(ehFrame, fde + 4 - cie);
+
+        arrpush(*relocations, ((Elf64Relocation)
+        {
+            .offset = arrlenu(*ehFrame),
+            .info   = ELF_RELOCATION_INFO(code[i].symbol, ELF_RELOCATION_X86_64_PC32),
+            .addend = code[i].offset
+        }));
+        push32(ehFrame, 0);
+        push32(ehFrame, functions[i].size);
+        pushUleb(ehFrame, 0);
+
+        usize cfiLen = arrlenu(functions[i].cfi);
+        arrsetlen(*ehFrame, fde + 17 + cfiLen);
+        if (cfiLen != 0) memcpy(*ehFrame + fde + 17, functions[i].cfi, cfiLen);
+
+        endFrameEntry(ehFrame, fde);
+    }
+}
+
+// a compile unit with no children but its line table and the range of .text,
+// or the ranges at `rangesSymbol` unless that is 0
+static void buildDebugInfo(u8 ** abbrev, u8 ** info, Elf64Relocation ** relocations, const SourceFile * source, usize programLen, u32 textSymbol, u32 rangesSymbol, u32 abbrevSymbol, u32 lineSymbol)
+{
+    pushUleb(abbrev, 1);
+    pushUleb(abbrev, DWARF_TAG_COMPILE_UNIT);
+    arrpush(*abbrev, DWARF_CHILDREN_NO);
+    pushUleb(abbrev, DWARF_AT_PRODUCER);  pushUleb(abbrev, DWARF_FORM_STRING);
+    pushUleb(abbrev, DWARF_AT_NAME);      pushUleb(abbrev, DWARF_FORM_STRING);
+    pushUleb(abbrev, DWARF_AT_COMP_DIR);  pushUleb(abbrev, DWARF_FORM_STRING);
+    pushUleb(abbrev, DWARF_AT_STMT_LIST); pushUleb(abbrev, DWARF_FORM_SEC_OFFSET);
+    pushUleb(abbrev, DWARF_AT_LOW_PC);    pushUleb(abbrev, DWARF_FORM_ADDR);
+    if (rangesSymbol != 0) { pushUleb(abbrev, DWARF_AT_RANGES);  pushUleb(abbrev, DWARF_FORM_SEC_OFFSET); }
+    else                   { pushUleb(abbrev, DWARF_AT_HIGH_PC); pushUleb(abbrev, DWARF_FORM_DATA8); }
+    pushUleb(abbrev, 0);                  pushUleb(abbrev, 0);
+    pushUleb(abbrev, 0);
+
+    char directory[4096];
+    if (getcwd(directory, sizeof(directory)) == NULL) directory[0] = '\0';
+
+    push32(info, 0);
+    push16(info, DWARF_VERSION_4);
+    arrpush(*relocations, ((Elf64Relocation){ arrlenu(*info), ELF_RELOCATION_INFO(abbrevSymbol, ELF_RELOCATION_X86_64_32), 0 }));
+    push32(info, 0);
+    // address size
+    arrpush(*info, 8);
+
+    pushUleb(info, 1);
+    pushString(info, COMPILER_VERSION);
+    pushString(info, source->path);
+    pushString(info, directory);
+    arrpush(*relocations, ((Elf64Relocation){ arrlenu(*info), ELF_RELOCATION_INFO(lineSymbol, ELF_RELOCATION_X86_64_32), 0 }));
+    push32(info, 0);
+    if (rangesSymbol != 0)
+    {
+        // the base address the ranges are relative to
+        push64(info, 0);
+        arrpush(*relocations, ((Elf64Relocation){ arrlenu(*info), ELF_RELOCATION_INFO(rangesSymbol, ELF_RELOCATION_X86_64_32), 0 }));
+        push32(info, 0);
+    }
+    else
+    {
+        arrpush(*relocations, ((Elf64Relocation){ arrlenu(*info), ELF_RELOCATION_INFO(textSymbol, ELF_RELOCATION_X86_64_64), 0 }));
+        push64(info, 0);
+        // the length of the range in version 4
+        push64(info, programLen);
+    }
+
+    put32At(*info, 0, arrlenu(*info) - 4);
+}
+
+// the range of every function, for code that isn't in a single section
+static void buildDebugRanges(u8 ** ranges, Elf64Relocation ** relocations, const FunctionCode * functions, const CodeReference * code, usize functionCount)
+{
+    for (usize i = 0; i < functionCount; i++)
+    {
+        arrpush(*relocations, ((Elf64Relocation){ arrlenu(*ranges), ELF_RELOCATION_INFO(code[i].symbol, ELF_RELOCATION_X86_64_64), code[i].offset }));
+        push64(ranges, 0);
+        arrpush(*relocations, ((Elf64Relocation){ arrlenu(*ranges), ELF_RELOCATION_INFO(code[i].symbol, ELF_RELOCATION_X86_64_64), code[i].offset + functions[i].size }));
+        push64(ranges, 0);
+    }
+
+    push64(ranges, 0);
+    push64(ranges, 0);
+}
+
+// the 1-based line of `source` that `offset` lies on, `lineStarts` holds the
+// offset every line starts at
+static u64 lineOf(const usize * lineStarts, usize offset)
+{
+    usize low = 0, high = arrlenu(lineStarts);
+
+    while (high - low > 1)
+    {
+        usize middle = low + (high - low) / 2;
+        if (lineStarts[middle] <= offset) low = middle;
+        else high = middle;
+    }
+
+    return low + 1;
+}
+
+// one sequence per function, since layout may leave them in any order
+static void buildDebugLine(u8 ** line, Elf64Relocation ** relocations, const SourceFile * source, const FunctionCode * functions, const CodeReference * code, usize functionCount)
+{
+    // FIXME: memory leak!
+    usize * lineStarts = NULL;
+    arrpush(lineStarts, 0);
+    for (usize i = 0; i < source->length; i++)
+    {
+        if (source->text[i] == '\n') arrpush(lineStarts, i + 1);
+    }
+
+    push32(line, 0);
+    push16(line, DWARF_VERSION_4);
+    push32(line, 0);
+    usize headerBegin = arrlenu(*line);
+
+    // minimum instruction length, maximum operations per instruction, default is_stmt
+    arrpush(*line, 1);
+    arrpush(*line, 1);
+    arrpush(*line, 1);
+    arrpush(*line, (u8) DWARF_LINE_BASE);
+    arrpush(*line, DWARF_LINE_RANGE);
+    arrpush(*line, DWARF_OPCODE_BASE);
+
+    // operand counts of the standard opcodes
+    static const u8 standardOpcodeLengths[DWARF_OPCODE_BASE - 1] = { 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1 };
+    for (usize i = 0; i < sizeof(standardOpcodeLengths); i++) arrpush(*line, standardOpcodeLengths[i]);
+
+    // no include directories, the only file is relative to the compile unit's
+    arrpush(*line, 0);
+    pushString(line, source->path);
+    pushUleb(line, 0);
+    pushUleb(line, 0);
+    pushUleb(line, 0);
+    arrpush(*line, 0);
+
+    put32At(*line, headerBegin - 4, arrlenu(*line) - headerBegin);
+
+    for (usize i = 0; i < functionCount; i++)
+    {
+        if (arrlenu(functions[i].lines) == 0) continue;
+
+        arrpush(*line, 0);
+        pushUleb(line, 9);
+        arrpush(*line, DWARF_LNE_SET_ADDRESS);
+        arrpush(*relocations, ((Elf64Relocation)
+        {
+            .offset = arrlenu(*line),
+            .info   = ELF_RELOCATION_INFO(code[i].symbol, ELF_RELOCATION_X86_64_64),
+            .addend = code[i].offset
+        }));
+        push64(line, 0);
+
+        u64 address = 0, currentLine = 1;
+        bool first = true;
+
+        for (usize j = 0; j < arrlenu(functions[i].lines); j++)
+        {
+            LineMapping mapping = functions[i].lines[j];
+            u64 mappedLine = lineOf(lineStarts, mapping.sourceOffset);
+
+            // different parts of one line are not told apart
+            if (mappedLine == currentLine && !first) continue;
+            first = false;
+
+            u64 addressDelta = mapping.address - address;
+            i64 lineDelta = (i64) mappedLine - (i64) currentLine;
+
+            u64 special = (u64)(lineDelta - DWARF_LINE_BASE) + DWARF_LINE_RANGE * addressDelta + DWARF_OPCODE_BASE;
+
+            if (lineDelta >= DWARF_LINE_BASE && lineDelta < DWARF_LINE_BASE + DWARF_LINE_RANGE && special <= 0xff)
+            {
+                arrpush(*line, special);
+            }
+            else
+            {
+                if (addressDelta != 0)
+                {
+                    arrpush(*line, DWARF_LNS_ADVANCE_PC);
+                    pushUleb(line, addressDelta);
+                }
+
+                if (lineDelta != 0)
+                {
+                    arrpush(*line, DWARF_LNS_ADVANCE_LINE);
+                    pushSleb(line, lineDelta);
+                }
+
+                arrpush(*line, DWARF_LNS_COPY);
+            }
+
+            address = mapping.address;
+            currentLine = mappedLine;
+        }
+
+        arrpush(*line, DWARF_LNS_ADVANCE_PC);
+        pushUleb(line, functions[i].size - address);
+        arrpush(*line, 0);
+        pushUleb(line, 1);
+        arrpush(*line, DWARF_LNE_END_SEQUENCE);
+    }
+
+    put32At(*line, 0, arrlenu(*line) - 4);
+}
+
+CallSite * resolveCalls(u8 * program, const Symbol * functionTable, const FunctionCode * functions, usize functionCount)
+{
+    struct { char * key; usize value; } * byName = NULL;
+    for (usize i = 0; i < functionCount; i++) shput(byName, (char *) functionTable[i].name, i);
+
+    CallSite * unresolved = NULL;
+
+    for (usize i = 0; i < functionCount; i++)
+    {
+        for (usize j = 0; j < arrlenu(functions[i].calls); j++)
+        {
+            CallSite call = functions[i].calls[j];
+            call.offset += functions[i].address;
+
+            i64 callee = shgeti(byName, (char *) call.callee);
+            if (callee < 0)
+            {
+                arrpush(unresolved, call);
+                continue;
+            }
+
+            // relative to the end of the call
+            put32At(program, call.offset, (u32)(functions[byName[callee].value].address - (call.offset + 4)));
+        }
+    }
+
+    shfree(byName);
+    return unresolved;
+}
+
+
+// a section with the relocations of the section `targetIndex`
+static usize addRelocationSection(Section ** sections, u32 name, usize symtabIndex, usize targetIndex, ElfSectionFlags flags)
+{
+    return addSection(sections, (Section)
+    {
+        .name         = name,
+        .type         = ELF_SECTION_TYPE_RELOC_ADDENDS,
+        .flags        = ELF_SECTION_FLAG_INFO_LINK | flags,
+        .link         = symtabIndex,
+        .info         = targetIndex,
+        .addressAlign = alignof(Elf64Relocation),
+        .entrySize    = sizeof(Elf64Relocation)
+    });
+}
+
+typedef struct {
+    char * key;
+    u32    value;
+} SymbolByName;
+
+// the symbol a call to `callee` is relocated against, an undefined one is added
+// the first time a function defined elsewhere is called
+static u32 calleeSymbol(Elf64Symbol ** symbolTable, StringTable * stringTable, SymbolByName ** symbols, char * callee)
+{
+    i64 existing = shgeti(*symbols, callee);
+    if (existing >= 0) return (*symbols)[existing].value;
+
+    u32 symbol = addSymbol(symbolTable, (Elf64Symbol)
+    {
+        .name               = addString(stringTable, callee),
+        .info               = ELF_SYMBOL_INFO(ELF_SYMBOL_BINDING_GLOBAL, ELF_SYMBOL_TYPE_NONE),
+        .other              = ELF_SYMBOL_OTHER(ELF_SYMBOL_VISIBILITY_DEFAULT),
+        .sectionHeaderIndex = ELF_SECTION_INDEX_UNDEFINED,
+        .value              = 0,
+        .size               = 0
+    }) / sizeof(Elf64Symbol);
+    shput(*symbols, callee, symbol);
+
+    return symbol;
+}
+
+// the name of the section of a function with `layout`, ld's default script
+// gathers hot and unlikely code in the same order layoutFunctions does
+static u32 addFunctionSectionName(StringTable * stringTable, const char * prefix, Layout layout, const char * name)
+{
+    const char * group = layout == LAYOUT_HOT ? "hot." : layout == LAYOUT_COLD ? "unlikely." : "";
+
+    char sectionName[strlen(prefix) + strlen(group) + strlen(name) + 1];
+    snprintf(sectionName, sizeof(sectionName), "%s%s%s", prefix, group, name);
+
+    return addString(stringTable, sectionName);
+}
+
+Image emitObject(u8 * program, usize programLen, const Symbol * functionTable, const FunctionCode * functions, usize functionCount, const SourceFile * source)
+{
+    bool functionSections = targetOptions.functionSections;
+
+    // calls within .text are resolved here, the others are left to the linker
+    CallSite * externalCalls = functionSections ? NULL : resolveCalls(program, functionTable, functions, functionCount);
+
+    StringTable stringTable = { 0 };
+    usize nullString = addString(&stringTable, "");
+
+    // contents are filled in once they are built
+    Section * sections = NULL;
+    addSection(&sections, (Section){ .name = nullString, .type = ELF_SECTION_TYPE_NULL });
+
+    usize strtabIndex = addSection(&sections, (Section)
+    {
+        .name         = addString(&stringTable, ".strtab"),
+        .type         = ELF_SECTION_TYPE_STRING_TABLE
+    });
+    usize symtabIndex = addSection(&sections, (Section)
+    {
+        .name         = addString(&stringTable, ".symtab"),
+        .type         = ELF_SECTION_TYPE_SYMBOL_TABLE,
+        .link         = strtabIndex,
+        .addressAlign = alignof(Elf64Symbol),
+        .entrySize    = sizeof(Elf64Symbol)
+    });
+
+    usize textIndex = 0;
+    if (!functionSections)
+    {
+        textIndex = addSection(&sections, (Section)
+        {
+            .name         = addString(&stringTable, ".text"),
+            .type         = ELF_SECTION_TYPE_DATA,
+            .flags        = ELF_SECTION_FLAG_ALLOC | ELF_SECTION_FLAG_EXEC,
+            .addressAlign = targetOptions.functionAlignment,
+            .data         = program,
+            .size         = programLen
+        });
+    }
+
+    usize ehFrameIndex = addSection(&sections, (Section)
+    {
+        .name         = addString(&stringTable, ".eh_frame"),
+        .type         = ELF_SECTION_TYPE_X86_64_UNWIND,
+        .flags        = ELF_SECTION_FLAG_ALLOC,
+        .addressAlign = 8
+    });
+    usize relaEhFrameIndex = addRelocationSection(&sections, addString(&stringTable, ".rela.eh_frame"), symtabIndex, ehFrameIndex, 0);
+
+    // nothing here needs an executable stack, without the note linkers assume it does
+    addSection(&sections, (Section)
+    {
+        .name         = addString(&stringTable, ".note.GNU-stack"),
+        .type         = ELF_SECTION_TYPE_DATA,
+        .addressAlign = 1
+    });
+
+    usize relaTextIndex = 0;
+    if (arrlenu(externalCalls) != 0) relaTextIndex = addRelocationSection(&sections, addString(&stringTable, ".rela.text"), symtabIndex, textIndex, 0);
+
+    usize abbrevIndex = 0, infoIndex = 0, relaInfoIndex = 0, lineIndex = 0, relaLineIndex = 0, rangesIndex = 0, relaRangesIndex = 0;
+
+    if (source != NULL)
+    {
+        abbrevIndex = addSection(&sections, (Section)
+        {
+            .name         = addString(&stringTable, ".debug_abbrev"),
+            .type         = ELF_SECTION_TYPE_DATA,
+            .addressAlign = 1
+        });
+        infoIndex = addSection(&sections, (Section)
+        {
+            .name         = addString(&stringTable, ".debug_info"),
+            .type         = ELF_SECTION_TYPE_DATA,
+            .addressAlign = 1
+        });
+        relaInfoIndex = addRelocationSection(&sections, addString(&stringTable, ".rela.debug_info"), symtabIndex, infoIndex, 0);
+        lineIndex = addSection(&sections, (Section)
+        {
+            .name         = addString(&stringTable, ".debug_line"),
+            .type         = ELF_SECTION_TYPE_DATA,
+            .addressAlign = 1
+        });
+        relaLineIndex = addRelocationSection(&sections, addString(&stringTable, ".rela.debug_line"), symtabIndex, lineIndex, 0);
+
+        // the compile unit no longer covers a single range
+        if (functionSections)
+        {
+            rangesIndex = addSection(&sections, (Section)
+            {
+                .name         = addString(&stringTable, ".debug_ranges"),
+                .type         = ELF_SECTION_TYPE_DATA,
+                .addressAlign = 1
+            });
+            relaRangesIndex = addRelocationSection(&sections, addString(&stringTable, ".rela.debug_ranges"), symtabIndex, rangesIndex, 0);
+        }
+    }
+
+    // with function sections, every function's code is a section of its own,
+    // which an inline function shares a COMDAT group with its relocations in
+    usize groupIndices[functionCount], codeIndices[functionCount], relaCodeIndices[functionCount];
+
+    for (usize i = 0; i < functionCount; i++)
+    {
+        groupIndices[i] = 0;
+        codeIndices[i] = textIndex;
+        relaCodeIndices[i] = 0;
+
+        if (!functionSections) continue;
+
+        bool isInline = functions[i].linkage == LINKAGE_INLINE;
+        ElfSectionFlags groupFlag = isInline ? ELF_SECTION_FLAG_GROUP : 0;
+
+        // a group has to come before its members
+        if (isInline)
+        {
+            groupIndices[i] = addSection(&sections, (Section)
+            {
+                .name         = addString(&stringTable, ".group"),
+                .type         = ELF_SECTION_TYPE_GROUP,
+                .link         = symtabIndex,
+                .addressAlign = sizeof(u32),
+                .entrySize    = sizeof(u32)
+            });
+        }
+
+        codeIndices[i] = addSection(&sections, (Section)
+        {
+            .name         = addFunctionSectionName(&stringTable, ".text.", functions[i].layout, (char *) functionTable[i].name),
+            .type         = ELF_SECTION_TYPE_DATA,
+            .flags        = ELF_SECTION_FLAG_ALLOC | ELF_SECTION_FLAG_EXEC | groupFlag,
+            .addressAlign = functions[i].layout == LAYOUT_COLD ? 1 : targetOptions.functionAlignment,
+            .data         = program + functions[i].address,
+            .size         = functions[i].size
+        });
+
+        if (arrlenu(functions[i].calls) != 0)
+        {
+            u32 name = addFunctionSectionName(&stringTable, ".rela.text.", functions[i].layout, (char *) functionTable[i].name);
+            relaCodeIndices[i] = addRelocationSection(&sections, name, symtabIndex, codeIndices[i], groupFlag);
+        }
+    }
+
+    usize functionNames[functionCount];
+    for (usize i = 0; i < functionCount; i++)
+    {
+        functionNames[i] = addString(&stringTable, (char *) functionTable[i].name);
+    }
+
+    Elf64Symbol * symbolTable = NULL;
+
+    addSymbol(&symbolTable, (Elf64Symbol)
+    {
+        .name               = nullString,
+        .info               = ELF_SYMBOL_INFO(ELF_SYMBOL_BINDING_LOCAL, ELF_SYMBOL_TYPE_NONE),
+        .other              = ELF_SYMBOL_OTHER(ELF_SYMBOL_VISIBILITY_DEFAULT),
+        .sectionHeaderIndex = 1,
+        .value              = 0,
+        .size               = 0
+    });
+
+    // relocations refer to sections through these instead of to the functions
+    u32 textSymbol = 0;
+    if (!functionSections) textSymbol = addSectionSymbol(&symbolTable, textIndex);
+
+    u32 abbrevSymbol = 0, lineSymbol = 0, rangesSymbol = 0;
+    if (source != NULL)
+    {
+        abbrevSymbol = addSectionSymbol(&symbolTable, abbrevIndex);
+        lineSymbol   = addSectionSymbol(&symbolTable, lineIndex);
+        if (functionSections) rangesSymbol = addSectionSymbol(&symbolTable, rangesIndex);
+    }
+
+    // FIXME: memory leak!
+    CodeReference * code = malloc(functionCount * sizeof(code[0]) + 1);
+    assert(code);
+
+    for (usize i = 0; i < functionCount; i++)
+    {
+        if (functionSections) code[i] = (CodeReference){ addSectionSymbol(&symbolTable, codeIndices[i]), 0 };
+        else code[i] = (CodeReference){ textSymbol, functions[i].address };
+    }
+
+    u32 firstGlobal = arrlenu(symbolTable);
+
+    // functions defined here, then the ones called but defined elsewhere
+    SymbolByName * symbols = NULL;
+
+    for (usize i = 0; i < functionCount; i++)
+    {
+        // every definition of an inline function but one is discarded
+        u8 binding = functions[i].linkage == LINKAGE_INLINE ? ELF_SYMBOL_BINDING_WEAK : ELF_SYMBOL_BINDING_GLOBAL;
+
+        u32 symbol = addSymbol(&symbolTable, (Elf64Symbol)
+        {
+            .name               = functionNames[i],
+            .info               = ELF_SYMBOL_INFO(binding, ELF_SYMBOL_TYPE_FUNCTION),
+            .other              = ELF_SYMBOL_OTHER(ELF_SYMBOL_VISIBILITY_DEFAULT),
+            .sectionHeaderIndex = codeIndices[i],
+            .value              = code[i].offset,
+            .size               = functions[i].size
+        }) / sizeof(Elf64Symbol);
+
+        if (functionSections) shput(symbols, (char *) functionTable[i].name, symbol);
+    }
+
+    // the displacement of a call is relative to its end, 4 bytes past it
+    // FIXME: memory leak!
+    Elf64Relocation * textRelocations = NULL;
+    for (usize i = 0; i < arrlenu(externalCalls); i++)
+    {
+        u32 symbol = calleeSymbol(&symbolTable, &stringTable, &symbols, (char *) externalCalls[i].callee);
+        arrpush(textRelocations, ((Elf64Relocation){ externalCalls[i].offset, ELF_RELOCATION_INFO(symbol, ELF_RELOCATION_X86_64_PLT32), -4 }));
+    }
+
+    if (relaTextIndex != 0) setSectionData(&sections[relaTextIndex], textRelocations, arrlenu(textRelocations) * sizeof(Elf64Relocation));
+
+    for (usize i = 0; i < functionCount; i++)
+    {
+        if (relaCodeIndices[i] != 0)
+        {
+            // FIXME: memory leak!
+            Elf64Relocation * relocations = NULL;
+
+            for (usize j = 0; j < arrlenu(functions[i].calls); j++)
+            {
+                CallSite call = functions[i].calls[j];
+                u32 symbol = calleeSymbol(&symbolTable, &stringTable, &symbols, (char *) call.callee);
+                arrpush(relocations, ((Elf64Relocation){ call.offset, ELF_RELOCATION_INFO(symbol, ELF_RELOCATION_X86_64_PLT32), -4 }));
+            }
+
+            setSectionData(&sections[relaCodeIndices[i]], relocations, arrlenu(relocations) * sizeof(Elf64Relocation));
+        }
+
+        if (groupIndices[i] != 0)
+        {
+            // the group is named after the function's symbol
+            sections[groupIndices[i]].info = firstGlobal + i;
+
+            // FIXME: memory leak!
+            u32 * group = NULL;
+            arrpush(group, ELF_GROUP_COMDAT);
+            arrpush(group, codeIndices[i]);
+            if (relaCodeIndices[i] != 0) arrpush(group, relaCodeIndices[i]);
+
+            setSectionData(&sections[groupIndices[i]], group, arrlenu(group) * sizeof(u32));
+        }
+    }
+
+    shfree(symbols);
+    arrfree(externalCalls);
+
+    // FIXME: memory leak!
+    u8 * ehFrame = NULL;
+    Elf64Relocation * frameRelocations = NULL;
+    buildEhFrame(&ehFrame, &frameRelocations, functions, code, functionCount);
+
+    setSectionData(&sections[ehFrameIndex], ehFrame, arrlenu(ehFrame));
+    setSectionData(&sections[relaEhFrameIndex], frameRelocations, arrlenu(frameRelocations) * sizeof(Elf64Relocation));
+
+    if (source != NULL)
+    {
+        // FIXME: memory leak!
+        u8 * abbrev = NULL;
+        u8 * info = NULL;
+        u8 * line = NULL;
+        u8 * ranges = NULL;
+        Elf64Relocation * infoRelocations = NULL;
+        Elf64Relocation * lineRelocations = NULL;
+        Elf64Relocation * rangesRelocations = NULL;
+
+        buildDebugInfo(&abbrev, &info, &infoRelocations, source, programLen, textSymbol, rangesSymbol, abbrevSymbol, lineSymbol);
+        buildDebugLine(&line, &lineRelocations, source, functions, code, functionCount);
+
+        setSectionData(&sections[abbrevIndex], abbrev, arrlenu(abbrev));
+        setSectionData(&sections[infoIndex], info, arrlenu(info));
+        setSectionData(&sections[relaInfoIndex], infoRelocations, arrlenu(infoRelocations) * sizeof(Elf64Relocation));
+        setSectionData(&sections[lineIndex], line, arrlenu(line));
+        setSectionData(&sections[relaLineIndex], lineRelocations, arrlenu(lineRelocations) * sizeof(Elf64Relocation));
+
+        if (functionSections)
+        {
+            buildDebugRanges(&ranges, &rangesRelocations, functions, code, functionCount);
+
+            setSectionData(&sections[rangesIndex], ranges, arrlenu(ranges));
+            setSectionData(&sections[relaRangesIndex], rangesRelocations, arrlenu(rangesRelocations) * sizeof(Elf64Relocation));
+        }
+    }
+
+    char * strings = finishStringTable(&stringTable, sections, arrlenu(sections), symbolTable, arrlenu(symbolTable));
+
+    sections[symtabIndex].info = firstGlobal;
+    setSectionData(&sections[symtabIndex], symbolTable, arrlenu(symbolTable) * sizeof(Elf64Symbol));
+    setSectionData(&sections[strtabIndex], strings, arrlenu(strings));
+
+    Image image = buildImage(ELF_TYPE_RELOCATABLE, 0, NULL, 0, sections, arrlenu(sections), strtabIndex);
+
+    arrfree(sections);
+    return image;
+}
@@ -0,0 +1,462 @@
+#include "x86_64.h"
+
+#include "assert.h"
+#include "stb_ds.h"
+
+// a peephole optimizer over the machine code of a single function. it runs
+// after register allocation and frame layout, and never makes a function
+// longer than it was
+
+typedef u8 ValueKind;
+#define VALUE_UNKNOWN  0
+#define VALUE_CONSTANT 1
+// some value computed at runtime, equal to every other value with the same id
+#define VALUE_OPAQUE   2
+
+typedef struct {
+    ValueKind kind;
+    i32       constant;
+    u32       id;
+} Value;
+
+typedef struct {
+    Value registers[16];
+    // frame slots by their displacement from rsp
+    struct { i32 key; Value value; } * memory;
+    u32 nextId;
+} KnownValues;
+
+typedef struct {
+    u16 registers;
+    // frame slots by their displacement from rsp
+    struct { i32 key; bool value; } * memory;
+    // set once memory that isn't a frame slot is read
+    bool allMemory;
+} Liveness;
+
+static bool isFrameSlot(Operand o)
+{
+    return o.kind == OPERAND_MEMORY && o.base == REG_RSP && o.index == REG_NONE;
+}
+
+static bool sameValue(Value a, Value b)
+{
+    if (a.kind == VALUE_UNKNOWN || a.kind != b.kind) return false;
+
+    return a.kind == VALUE_CONSTANT ? a.constant == b.constant : a.id == b.id;
+}
+
+static Value readOperand(KnownValues * known, Operand o)
+{
+    switch (o.kind)
+    {
+        case OPERAND_IMMEDIATE: return (Value){ VALUE_CONSTANT, .constant = o.immediate };
+        case OPERAND_REGISTER:
+        {
+            if (known->registers[o.reg].kind == VALUE_UNKNOWN) known->registers[o.reg] = (Value){ VALUE_OPAQUE, .id = ++known->nextId };
+            return known->registers[o.reg];
+        }
+        case OPERAND_MEMORY:
+        {
+            Value value = { VALUE_OPAQUE, .id = ++known->nextId };
+            if (!isFrameSlot(o)) return value;
+
+            ptrdiff_t i = hmgeti(known->memory, o.displacement);
+            if (i >= 0) return known->memory[i].value;
+
+            hmput(known->memory, o.displacement, value);
+            return value;
+        }
+        default: assert(0);
+    }
+}
+
+static void writeOperand(KnownValues * known, Operand o, Value value)
+{
+    if (o.kind == OPERAND_REGISTER)
+    {
+        known->registers[o.reg] = value;
+        return;
+    }
+
+    assert(o.kind == OPERAND_MEMORY);
+
+    if (!isFrameSlot(o))
+    {
+        hmfree(known->memory);
+        return;
+    }
+
+    // forget every slot the 4 bytes written overlap
+    for (i32 d = -3; d <= 3; d++)
+    {
+        if (known->memory != NULL) (void) hmdel(known->memory, o.displacement + d);
+    }
+
+    hmput(known->memory, o.displacement, value);
+}
+
+// replaces the source of `mi` with a cheaper operand holding `value`: an
+// immediate, which leaves the instruction that produced it for dead, or else
+// a register in place of memory
+static void cheaperSource(KnownValues * known, MachineInstruction * mi, Value value)
+{
+    if (value.kind == VALUE_CONSTANT)
+    {
+        mi->src = (Operand){ OPERAND_IMMEDIATE, .immediate = value.constant };
+        return;
+    }
+
+    if (mi->src.kind != OPERAND_MEMORY) return;
+
+    usize length = encodedLength(mi);
+    MachineInstruction candidate = *mi;
+
+    for (Register r = 0; r < 16; r++)
+    {
+        if (r == REG_RSP || !sameValue(known->registers[r], value)) continue;
+
+        candidate.src = (Operand){ OPERAND_REGISTER, .reg = r };
+
+        usize candidateLength = encodedLength(&candidate);
+        if (candidateLength < length) { *mi = candidate; length = candidateLength; }
+    }
+}
+
+// forwards known values into later instructions, deleting the ones that don't
+// change anything
+static bool forwardValues(MachineInstruction * code)
+{
+    KnownValues known = { 0 };
+    bool changed = false;
+
+    for (usize i = 0; i < arrlenu(code); i++)
+    {
+        MachineInstruction * mi = &code[i];
+
+        switch (mi->op)
+        {
+            case MO_NONE: break;
+            case MO_MOV:
+            {
+                Value value = readOperand(&known, mi->src);
+
+                if (sameValue(readOperand(&known, mi->dst), value))
+                {
+                    mi->op = MO_NONE;
+                    changed = true;
+                    break;
+                }
+
+                MachineInstruction before = *mi;
+                cheaperSource(&known, mi, value);
+                changed |= !sameOperand(before.src, mi->src);
+
+                writeOperand(&known, mi->dst, value);
+            } break;
+            case MO_ADD:
+            {
+                Value src = readOperand(&known, mi->src);
+                Value dst = readOperand(&known, mi->dst);
+
+                // nothing reads the flags
+                if (src.kind == VALUE_CONSTANT && src.constant == 0)
+                {
+                    mi->op = MO_NONE;
+                    changed = true;
+                    break;
+                }
+
+                MachineInstruction before = *mi;
+                cheaperSource(&known, mi, src);
+
+                if (src.kind == VALUE_CONSTANT && dst.kind == VALUE_CONSTANT)
+                {
+                    i32 sum = (i32)((u32) dst.constant + (u32) src.constant);
+                    *mi = (MachineInstruction){ MO_MOV, mi->dst, { OPERAND_IMMEDIATE, .immediate = sum }, mi->sourceOffset };
+
+                    writeOperand(&known, mi->dst, (Value){ VALUE_CONSTANT, .constant = sum });
+                }
+                else writeOperand(&known, mi->dst, (Value){ VALUE_OPAQUE, .id = ++known.nextId });
+
+                changed |= mi->op != before.op || !sameOperand(before.src, mi->src);
+            } break;
+            case MO_XOR:
+            {
+                Value value = sameOperand(mi->dst, mi->src) ? (Value){ VALUE_CONSTANT, .constant = 0 } : (Value){ VALUE_OPAQUE, .id = ++known.nextId };
+                writeOperand(&known, mi->dst, value);
+            } break;
+            case MO_LEA:
+            {
+                MachineInstruction before = *mi;
+
+                // known registers fold into the displacement
+                Operand * address = &mi->src;
+                if (address->index != REG_NONE)
+                {
+                    Value index = readOperand(&known, (Operand){ OPERAND_REGISTER, .reg = address->index });
+                    if (index.kind == VALUE_CONSTANT)
+                    {
+                        address->displacement = (i32)((u32) address->displacement + (u32) index.constant);
+                        address->index = REG_NONE;
+                    }
+                }
+                if (address->base != REG_NONE)
+                {
+                    Value base = readOperand(&known, (Operand){ OPERAND_REGISTER, .reg = address->base });
+                    if (base.kind == VALUE_CONSTANT)
+                    {
+                        address->displacement = (i32)((u32) address->displacement + (u32) base.constant);
+                        address->base = address->index;
+                        address->index = REG_NONE;
+                    }
+                }
+
+                if (address->base == REG_NONE)
+                {
+                    *mi = (MachineInstruction){ MO_MOV, mi->dst, { OPERAND_IMMEDIATE, .immediate = address->displacement }, mi->sourceOffset };
+                    writeOperand(&known, mi->dst, (Value){ VALUE_CONSTANT, .constant = mi->src.immediate });
+                }
+                else writeOperand(&known, mi->dst, (Value){ VALUE_OPAQUE, .id = ++known.nextId });
+
+                changed |= mi->op != before.op || !sameOperand(before.src, mi->src);
+            } break;
+            // rsp moves, so every slot is addressed differently afterwards
+            case MO_POP:     known.registers[mi->dst.reg] = (Value){ 0 }; // fallthrough
+            case MO_PUSH:
+            case MO_SUB_RSP:
+            case MO_ADD_RSP: hmfree(known.memory); break;
+            case MO_CALL:
+            {
+                // the callee can't address the frame of its caller
+                for (Register r = 0; r < 16; r++)
+                {
+                    if ((CALLER_SAVED_REGISTERS >> r) & 1) known.registers[r] = (Value){ 0 };
+                }
+            } break;
+            case MO_RET:
+            case MO_SYSCALL:
+            {
+                memset(known.registers, 0, sizeof(known.registers));
+                hmfree(known.memory);
+            } break;
+            default: assert(0 && "TODO:");
+        }
+    }
+
+    hmfree(known.memory);
+    return changed;
+}
+
+static bool isLive(Liveness * live, Operand o)
+{
+    if (o.kind == OPERAND_REGISTER) return (live->registers >> o.reg) & 1;
+    if (!isFrameSlot(o)) return true;
+
+    return live->allMemory || hmgeti(live->memory, o.displacement) >= 0;
+}
+
+static void useOperand(Liveness * live, Operand o)
+{
+    switch (o.kind)
+    {
+        case OPERAND_REGISTER: live->registers |= 1 << o.reg; break;
+        case OPERAND_MEMORY:
+        {
+            if (isFrameSlot(o))
+            {
+                hmput(live->memory, o.displacement, true);
+                break;
+            }
+
+            live->allMemory = true;
+            if (o.base  != REG_NONE) live->registers |= 1 << o.base;
+            if (o.index != REG_NONE) live->registers |= 1 << o.index;
+        } break;
+        default: break;
+    }
+}
+
+static void defineOperand(Liveness * live, Operand o)
+{
+    if (o.kind == OPERAND_REGISTER)
+    {
+        live->registers &= ~(1 << o.reg);
+        return;
+    }
+
+    assert(o.kind == OPERAND_MEMORY);
+
+    // every slot is 4 bytes wide and 4-byte aligned, so a store either covers
+    // a slot completely or not at all
+    if (isFrameSlot(o))
+    {
+        if (live->memory != NULL) (void) hmdel(live->memory, o.displacement);
+        return;
+    }
+
+    if (o.base  != REG_NONE) live->registers |= 1 << o.base;
+    if (o.index != REG_NONE) live->registers |= 1 << o.index;
+}
+
+static void forgetMemory(Liveness * live)
+{
+    hmfree(live->memory);
+    live->allMemory = false;
+}
+
+// deletes instructions whose result is never read
+static bool removeDeadCode(MachineInstruction * code)
+{
+    Liveness live = { 0 };
+    bool changed = false;
+
+    for (usize i = arrlenu(code); i-- > 0;)
+    {
+        MachineInstruction * mi = &code[i];
+
+        switch (mi->op)
+        {
+            case MO_NONE: break;
+            case MO_MOV:
+            case MO_XOR:
+            case MO_LEA:
+            {
+                if (!isLive(&live, mi->dst))
+                {
+                    mi->op = MO_NONE;
+                    changed = true;
+                    break;
+                }
+
+                defineOperand(&live, mi->dst);
+                // xor r, r doesn't depend on r
+                if (mi->op != MO_XOR || !sameOperand(mi->dst, mi->src)) useOperand(&live, mi->src);
+            } break;
+            case MO_ADD:
+            {
+                if (!isLive(&live, mi->dst))
+                {
+                    mi->op = MO_NONE;
+                    changed = true;
+                    break;
+                }
+
+                useOperand(&live, mi->src);
+            } break;
+            // the frame only exists between the prologue and the epilogue
+            case MO_PUSH:    useOperand(&live, mi->src); forgetMemory(&live); break;
+            case MO_POP:     defineOperand(&live, mi->dst); forgetMemory(&live); break;
+            case MO_SUB_RSP:
+            case MO_ADD_RSP: forgetMemory(&live); break;
+            // takes no arguments, but the caller-saved registers hold nothing
+            // from before it
+            case MO_CALL:    live.registers &= ~CALLER_SAVED_REGISTERS; break;
+            case MO_RET:
+            {
+                // the pops restoring callee-saved registers are only added after this pass
+                live.registers = 1 << REG_RAX;
+                forgetMemory(&live);
+            } break;
+            case MO_SYSCALL:
+            {
+                // the only syscall lowered is exit, which never returns
+                live.registers = 1 << REG_RAX | 1 << REG_RDI;
+                forgetMemory(&live);
+            } break;
+            default: assert(0 && "TODO:");
+        }
+    }
+
+    hmfree(live.memory);
+    return changed;
+}
+
+// rewrites short sequences into shorter equivalents
+static void combine(MachineInstruction * code)
+{
+    for (usize i = 0; i < arrlenu(code); i++)
+    {
+        MachineInstruction * mi = &code[i];
+
+        // mov r, 0 -> xor r, r
+        if (mi->op == MO_MOV && mi->dst.kind == OPERAND_REGISTER && mi->src.kind == OPERAND_IMMEDIATE && mi->src.immediate == 0)
+        {
+            *mi = (MachineInstruction){ MO_XOR, mi->dst, mi->dst, mi->sourceOffset };
+            continue;
+        }
+
+        // mov r1, r2; add r1, r3 -> lea r1, [r2 + r3]
+        if (mi->op != MO_MOV || mi->dst.kind != OPERAND_REGISTER || mi->src.kind != OPERAND_REGISTER) continue;
+
+        usize j = i + 1;
+        while (j < arrlenu(code) && code[j].op == MO_NONE) j++;
+        if (j == arrlenu(code)) break;
+
+        MachineInstruction * add = &code[j];
+        if (add->op != MO_ADD || !sameOperand(add->dst, mi->dst)) continue;
+
+        Operand address = { OPERAND_MEMORY, .base = mi->src.reg, .index = REG_NONE, .displacement = 0 };
+
+        if (add->src.kind == OPERAND_IMMEDIATE) address.displacement = add->src.immediate;
+        else if (add->src.kind == OPERAND_REGISTER && add->src.reg != mi->dst.reg)
+        {
+            address.index = add->src.reg;
+            // rsp can't be an index
+            if (address.index == REG_RSP) { address.index = address.base; address.base = REG_RSP; }
+            if (address.index == REG_RSP) continue;
+        }
+        else continue;
+
+        MachineInstruction lea = { MO_LEA, mi->dst, address, mi->sourceOffset };
+
+        if (encodedLength(&lea) < encodedLength(mi) + encodedLength(add))
+        {
+            *mi = lea;
+            add->op = MO_NONE;
+        }
+    }
+}
+
+static usize codeLength(const MachineInstruction * code)
+{
+    usize length = 0;
+    for (usize i = 0; i < arrlenu(code); i++)
+    {
+        if (code[i].op != MO_NONE) length += encodedLength(&code[i]);
+    }
+    return length;
+}
+
+void peephole(MachineInstruction ** code)
+{
+    MachineInstruction * original = NULL;
+    arrsetlen(original, arrlenu(*code));
+    if (original != NULL) memcpy(original, *code, arrlenu(*code) * sizeof(original[0]));
+
+    // forwarding a constant lengthens an instruction until the one producing
+    // it is found dead, a few rounds are enough to reach a fixed point in practice
+    for (usize round = 0; round < 4; round++)
+    {
+        bool changed = forwardValues(*code);
+        changed |= removeDeadCode(*code);
+        if (!changed) break;
+    }
+
+    combine(*code);
+
+    // whatever was left alive by the forwarding may not pay for itself
+    if (codeLength(*code) > codeLength(original))
+    {
+        memcpy(*code, original, arrlenu(original) * sizeof(original[0]));
+    }
+
+    usize length = 0;
+    for (usize i = 0; i < arrlenu(*code); i++)
+    {
+        if ((*code)[i].op != MO_NONE) (*code)[length++] = (*code)[i];
+    }
+    if (*code != NULL) stbds_header(*code)->length = length;
+
+    arrfree(original);
+}